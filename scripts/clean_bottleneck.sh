@@ -0,0 +1,10 @@
+#!/bin/sh
+
+set -u
+
+TAP_NAME="tap0"
+IFB_NAME="ifb0"
+
+sudo tc qdisc del dev $TAP_NAME ingress
+sudo tc qdisc del dev $IFB_NAME root
+sudo ip link set $IFB_NAME down
@@ -0,0 +1,24 @@
+#!/usr/bin/env python3
+# HTTP server on the host accepting TCP Fast Open, for src/test/tcp-fastopen-client.exe
+# requires: sysctl -w net.ipv4.tcp_fastopen=3
+
+import socket
+
+BODY = b"hello fastopen\n"
+
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.setsockopt(socket.IPPROTO_TCP, socket.TCP_FASTOPEN, 16)
+s.bind(("192.168.70.1", 8080))
+s.listen(16)
+while True:
+    c, addr = s.accept()
+    req = b""
+    while b"\r\n\r\n" not in req:
+        data = c.recv(4096)
+        if not data:
+            break
+        req += data
+    c.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: close\r\n\r\n" % len(BODY) + BODY)
+    c.close()
+    print("served", addr, flush=True)
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+set -u
+
+# Emulates a bottleneck on the path from the protocol stack to the host.
+# Frames written to the tap are redirected to an ifb device and shaped there.
+
+TAP_NAME="tap0"
+IFB_NAME="ifb0"
+RATE="${1:-20mbit}"
+DELAY="${2:-20ms}"
+LIMIT="${3:-64kb}" # bottleneck queue
+
+sudo modprobe ifb numifbs=1
+sudo ip link add $IFB_NAME type ifb 2>/dev/null
+sudo ip link set $IFB_NAME up
+sudo tc qdisc add dev $TAP_NAME handle ffff: ingress
+sudo tc filter add dev $TAP_NAME parent ffff: protocol all u32 match u32 0 0 action mirred egress redirect dev $IFB_NAME
+sudo tc qdisc add dev $IFB_NAME root handle 1: tbf rate $RATE burst 16kb limit $LIMIT
+sudo tc qdisc add dev $IFB_NAME parent 1:1 handle 10: netem delay $DELAY
@@ -20,13 +20,37 @@
 #define ARP_OP_REQUEST 1
 #define ARP_OP_REPLY 2
 
-#define ARP_CACHE_SIZE 32
-#define ARP_CACHE_TIMEOUT 30 /* seconds */
+/* NOTE: must be a power of 2, may be overridden from CFLAGS (e.g. -DARP_CACHE_SIZE=65536) for a large segment */
+#ifndef ARP_CACHE_SIZE
+#define ARP_CACHE_SIZE 1024
+#endif
+
+#define ARP_REACHABLE_TIME 30 /* seconds a reply is trusted as it is */
+#define ARP_STALE_TIMEOUT 60  /* seconds a stale entry is kept without being used */
+#define ARP_PROBE_MAX 3       /* unicast requests sent to a stale entry in use before it is given up */
+#define ARP_PROBE_INTERVAL 1  /* seconds between two probes */
+#define ARP_PROBE_BATCH 64    /* probes started per slice of the sweep at most */
+
+#define ARP_SWEEP_INTERVAL 100 /* milliseconds between two slices of the sweep */
+#define ARP_SWEEP_BATCH 1024   /* entries checked per slice, a sweep takes ARP_CACHE_SIZE / ARP_SWEEP_BATCH slices */
+
+#define ARP_PENDING_MAX 16       /* datagrams held per incomplete entry */
+#define ARP_REQUEST_INTERVAL 500 /* milliseconds, doubled for each retry */
+#define ARP_REQUEST_MAX 3        /* requests sent before the target is given up */
+#define ARP_FAILED_TIMEOUT 5     /* seconds a given up target is reported unreachable without a request */
 
 #define ARP_CACHE_STATE_FREE 0
 #define ARP_CACHE_STATE_INCOMPLETE 1
-#define ARP_CACHE_STATE_RESOLVED 2
+#define ARP_CACHE_STATE_REACHABLE 2
 #define ARP_CACHE_STATE_STATIC 3
+#define ARP_CACHE_STATE_FAILED 4
+#define ARP_CACHE_STATE_STALE 5
+#define ARP_CACHE_STATE_PROBE 6
+
+/* NOTE: the link address of a stale or probed entry is still used while it is being confirmed */
+#define ARP_CACHE_STATE_USABLE(x)                                                                      \
+  ((x) == ARP_CACHE_STATE_REACHABLE || (x) == ARP_CACHE_STATE_STALE || (x) == ARP_CACHE_STATE_PROBE || \
+   (x) == ARP_CACHE_STATE_STATIC)
 
 struct arp_hdr {
   uint16_t hrd;
@@ -49,10 +73,29 @@ struct arp_cache {
   ip_addr_t pa;
   uint8_t ha[ETHER_ADDR_LEN];
   struct timeval timestamp;
+  int next;                   /* index in the bucket or in the free list, -1 for the end */
+  int older, newer;           /* neighbors on the aging list, -1 for the ends */
+  unsigned int used;          /* looked up while stale, set without the mutex */
+  struct net_iface *iface;    /* the requests are sent from */
+  unsigned int requests;      /* sent while incomplete or probed */
+  struct queue_head pending;  /* datagrams waiting for the reply */
+  struct net_timeout timeout; /* next request, or end of the failure */
+};
+
+struct arp_pending {
+  size_t len;
+  uint8_t data[];
 };
 
 static mutex_t mutex = MUTEX_INITIALIZER;
+static seqlock_t seq; /* for the lookups without the mutex, see arp_cache_lookup() */
 static struct arp_cache caches[ARP_CACHE_SIZE];
+static int buckets[ARP_CACHE_SIZE]; /* index of the first entry of the chain, -1 if empty */
+static int free_list;
+static int oldest = -1, newest = -1; /* aging list of the entries in use (but static ones), ordered by timestamp */
+static int sweep;                    /* next entry checked by arp_timer_handler() */
+static struct arp_stats stats;
+static unsigned int stale_generation = 1; /* see arp_stale_generation() */
 
 static char *arp_opcode_ntoa(uint16_t opcode) {
   switch (ntoh16(opcode)) {
@@ -91,51 +134,189 @@ static void arp_dump(const uint8_t *data, size_t len) {
 /*
  * ARP Cache
  *
- * NOTE: ARP Cache functions must be called after mutex locked
+ * NOTE: ARP Cache functions must be called after mutex locked, except arp_cache_lookup() which takes no lock
  */
 
+static unsigned int arp_cache_hash(ip_addr_t pa) {
+  uint32_t h;
+
+  h = ntoh32(pa);
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return h & (ARP_CACHE_SIZE - 1);
+}
+
+static void arp_cache_pending_drop(struct arp_cache *cache) {
+  struct arp_pending *entry;
+
+  while ((entry = queue_pop(&cache->pending)) != NULL) {
+    stats.pending_drops++;
+    memory_free(entry);
+  }
+}
+
+static void arp_cache_set_state(struct arp_cache *cache, unsigned char state) {
+  seqlock_write_begin(&seq);
+  cache->state = state;
+  seqlock_write_end(&seq);
+}
+
+static void arp_cache_age_unlink(struct arp_cache *cache) {
+  if (cache->older != -1) {
+    caches[cache->older].newer = cache->newer;
+  } else {
+    oldest = cache->newer;
+  }
+  if (cache->newer != -1) {
+    caches[cache->newer].older = cache->older;
+  } else {
+    newest = cache->older;
+  }
+  cache->older = cache->newer = -1;
+}
+
+/* NOTE: stamps the entry and moves it to the newest end of the aging list, evicted last */
+static void arp_cache_age_refresh(struct arp_cache *cache) {
+  int index;
+
+  gettimeofday(&cache->timestamp, NULL);
+  index = cache - caches;
+  if (index == newest) {
+    return;
+  }
+  if (cache->older != -1 || oldest == index) {
+    arp_cache_age_unlink(cache);
+  }
+  cache->older = newest;
+  if (newest != -1) {
+    caches[newest].newer = index;
+  } else {
+    oldest = index;
+  }
+  newest = index;
+}
+
 static void arp_cache_delete(struct arp_cache *cache) {
+  int *p, index;
+  unsigned char state;
   char addr1[IP_ADDR_STR_LEN];
   char addr2[ETHER_ADDR_STR_LEN];
 
   debugf("DELETE: pa=%s, ha=%s", ip_addr_ntop(cache->pa, addr1, sizeof(addr1)),
          ether_addr_ntop(cache->ha, addr2, sizeof(addr2)));
 
+  state = cache->state;
+  index = cache - caches;
+  if (state != ARP_CACHE_STATE_STATIC) {
+    arp_cache_age_unlink(cache);
+  }
+  seqlock_write_begin(&seq);
+  for (p = &buckets[arp_cache_hash(cache->pa)]; *p != -1; p = &caches[*p].next) {
+    if (*p == index) {
+      *p = cache->next;
+      break;
+    }
+  }
   cache->state = ARP_CACHE_STATE_FREE;
   cache->pa = 0;
   memset(cache->ha, 0, ETHER_ADDR_LEN);
+  cache->next = free_list;
+  free_list = index;
+  seqlock_write_end(&seq);
+  if (ARP_CACHE_STATE_USABLE(state)) {
+    ip_dst_cache_invalidate();
+  }
   timerclear(&cache->timestamp);
+  cache->iface = NULL;
+  cache->requests = 0;
+  atomic_write(&cache->used, 0);
+  arp_cache_pending_drop(cache);
+  net_timeout_cancel(&cache->timeout);
 }
 
-static struct arp_cache *arp_cache_alloc(void) {
-  struct arp_cache *entry, *oldest = NULL;
+/* NOTE: ha may be NULL for an incomplete entry, the oldest entry is dropped if the table is full */
+static struct arp_cache *arp_cache_alloc(ip_addr_t pa, unsigned char state, const uint8_t *ha) {
+  struct arp_cache *cache;
+  unsigned int hash;
 
-  for (entry = caches; entry < tailof(caches); entry++) {
-    if (entry->state == ARP_CACHE_STATE_FREE) {
-      return entry;
-    }
-    if (!oldest || timercmp(&oldest->timestamp, &entry->timestamp, >)) {
-      oldest = entry;
+  if (free_list == -1) {
+    if (oldest == -1) {
+      return NULL; /* NOTE: all static */
     }
+    arp_cache_delete(&caches[oldest]);
   }
-
-  arp_cache_delete(oldest);
-  return oldest;
+  cache = &caches[free_list];
+  hash = arp_cache_hash(pa);
+  seqlock_write_begin(&seq);
+  free_list = cache->next;
+  cache->state = state;
+  cache->pa = pa;
+  if (ha) {
+    memcpy(cache->ha, ha, ETHER_ADDR_LEN);
+  }
+  cache->next = buckets[hash];
+  buckets[hash] = cache - caches;
+  seqlock_write_end(&seq);
+  if (state == ARP_CACHE_STATE_STATIC) {
+    gettimeofday(&cache->timestamp, NULL);
+  } else {
+    arp_cache_age_refresh(cache);
+  }
+  return cache;
 }
 
 static struct arp_cache *arp_cache_select(ip_addr_t pa) {
-  struct arp_cache *entry;
-  for (entry = caches; entry < tailof(caches); entry++) {
-    if (entry->state != ARP_CACHE_STATE_FREE && entry->pa == pa) {
-      return entry;
+  int index;
+
+  for (index = buckets[arp_cache_hash(pa)]; index != -1; index = caches[index].next) {
+    if (caches[index].pa == pa) {
+      return &caches[index];
     }
   }
-
   return NULL;
 }
 
+/*
+ * returns 1 and the link address if pa has an entry that can be used as it is. A stale entry is marked as used so that
+ * arp_timer_handler() refreshes it.
+ *
+ * NOTE: the walk is bounded because a chain changed under it may lead anywhere in the table (never out of it), the
+ * result is then thrown away by seqlock_read_retry().
+ */
+static int arp_cache_lookup(ip_addr_t pa, uint8_t *ha) {
+  struct arp_cache *entry;
+  unsigned int start, steps;
+  unsigned char state;
+  int index;
+
+  do {
+    start = seqlock_read_begin(&seq);
+    entry = NULL;
+    state = ARP_CACHE_STATE_FREE;
+    index = buckets[arp_cache_hash(pa)];
+    for (steps = 0; index >= 0 && index < ARP_CACHE_SIZE && steps < ARP_CACHE_SIZE; steps++) {
+      if (caches[index].pa == pa) {
+        entry = &caches[index];
+        state = entry->state;
+        memcpy(ha, entry->ha, ETHER_ADDR_LEN);
+        break;
+      }
+      index = caches[index].next;
+    }
+  } while (seqlock_read_retry(&seq, start));
+  if (!entry || !ARP_CACHE_STATE_USABLE(state)) {
+    return 0;
+  }
+  if (state == ARP_CACHE_STATE_STALE && !atomic_read(&entry->used)) {
+    atomic_write(&entry->used, 1);
+  }
+  return 1;
+}
+
 static struct arp_cache *arp_cache_update(ip_addr_t pa, const uint8_t *ha) {
   struct arp_cache *cache;
+  int moved;
   char addr1[IP_ADDR_STR_LEN];
   char addr2[ETHER_ADDR_STR_LEN];
 
@@ -146,30 +327,43 @@ static struct arp_cache *arp_cache_update(ip_addr_t pa, const uint8_t *ha) {
     return NULL;
   }
 
-  cache->state = ARP_CACHE_STATE_RESOLVED;
+  moved = ARP_CACHE_STATE_USABLE(cache->state) && memcmp(cache->ha, ha, ETHER_ADDR_LEN) != 0;
+  if (cache->state == ARP_CACHE_STATE_INCOMPLETE || cache->state == ARP_CACHE_STATE_FAILED ||
+      cache->state == ARP_CACHE_STATE_PROBE) {
+    net_timeout_cancel(&cache->timeout);
+  }
+  cache->requests = 0;
+  seqlock_write_begin(&seq);
+  cache->state = ARP_CACHE_STATE_REACHABLE;
   memcpy(cache->ha, ha, ETHER_ADDR_LEN);
-  gettimeofday(&cache->timestamp, NULL);
+  seqlock_write_end(&seq);
+  arp_cache_age_refresh(cache);
+  if (moved) {
+    ip_dst_cache_invalidate(); /* the neighbor has moved */
+  }
 
   debugf("UPDATE: pa=%s, ha=%s", ip_addr_ntop(pa, addr1, sizeof(addr1)), ether_addr_ntop(ha, addr2, sizeof(addr2)));
   return cache;
 }
 
-static struct arp_cache *arp_cache_insert(ip_addr_t pa, const uint8_t *ha) {
+static struct arp_cache *arp_cache_insert(struct net_iface *iface, ip_addr_t pa, const uint8_t *ha) {
   struct arp_cache *cache;
   char addr1[IP_ADDR_STR_LEN];
   char addr2[ETHER_ADDR_STR_LEN];
 
-  cache = arp_cache_alloc();
-  cache->state = ARP_CACHE_STATE_RESOLVED;
-  cache->pa = pa;
-  memcpy(cache->ha, ha, ETHER_ADDR_LEN);
-  gettimeofday(&cache->timestamp, NULL);
+  cache = arp_cache_alloc(pa, ARP_CACHE_STATE_REACHABLE, ha);
+  if (!cache) {
+    errorf("arp_cache_alloc() failure");
+    return NULL;
+  }
+  cache->iface = iface;
 
   debugf("INSERT: pa=%s, ha=%s", ip_addr_ntop(pa, addr1, sizeof(addr1)), ether_addr_ntop(ha, addr2, sizeof(addr2)));
   return cache;
 }
 
-static int arp_request(struct net_iface *iface, ip_addr_t tpa) {
+/* NOTE: broadcasted if dst is NULL, otherwise sent to dst only to confirm the entry it is cached for */
+static int arp_request(struct net_iface *iface, ip_addr_t tpa, const uint8_t *dst) {
   struct arp_ether_ip request;
   request.hdr.hrd = hton16(ARP_HRD_ETHER);
   request.hdr.pro = hton16(ARP_PRO_IP);
@@ -178,13 +372,18 @@ static int arp_request(struct net_iface *iface, ip_addr_t tpa) {
   request.hdr.op = hton16(ARP_OP_REQUEST);
   memcpy(request.sha, iface->dev->addr, ETHER_ADDR_LEN);
   memcpy(request.spa, &((struct ip_iface *)iface)->unicast, IP_ADDR_LEN);
-  memset(request.tha, 0, ETHER_ADDR_LEN);
+  if (dst) {
+    memcpy(request.tha, dst, ETHER_ADDR_LEN);
+  } else {
+    memset(request.tha, 0, ETHER_ADDR_LEN);
+  }
   memcpy(request.tpa, &tpa, IP_ADDR_LEN);
 
   debugf("dev=%s, len=%zu", iface->dev->name, sizeof(request));
   arp_dump((uint8_t *)&request, sizeof(request));
 
-  return net_device_output(iface->dev, ETHER_TYPE_ARP, (uint8_t *)&request, sizeof(request), iface->dev->broadcast);
+  return net_device_output(iface->dev, ETHER_TYPE_ARP, (uint8_t *)&request, sizeof(request),
+                           dst ? dst : iface->dev->broadcast);
 }
 
 static int arp_reply(struct net_iface *iface, const uint8_t *tha, ip_addr_t tpa, const uint8_t *dst) {
@@ -205,6 +404,95 @@ static int arp_reply(struct net_iface *iface, const uint8_t *tha, ip_addr_t tpa,
   return net_device_output(iface->dev, ETHER_TYPE_ARP, (uint8_t *)&reply, sizeof(reply), dst);
 }
 
+/*
+ * Requests
+ *
+ * NOTE: an incomplete entry sends a request when it is created, then repeats it with an exponential backoff from the
+ * timeout of the entry rather than on each lookup, so that a busy sender does not flood the link. The target is given
+ * up after ARP_REQUEST_MAX requests, its held datagrams are dropped and it is reported unreachable for a while.
+ */
+
+/* NOTE: must be called after mutex locked, the request itself is sent by the caller after the mutex is released */
+static void arp_cache_request(struct arp_cache *cache) {
+  struct timeval now, interval, expire;
+  unsigned long ms;
+
+  ms = ARP_REQUEST_INTERVAL << cache->requests;
+  interval.tv_sec = ms / 1000;
+  interval.tv_usec = ms % 1000 * 1000;
+  gettimeofday(&now, NULL);
+  timeradd(&now, &interval, &expire);
+  net_timeout_arm(&cache->timeout, &expire);
+  cache->requests++;
+  stats.requests++;
+}
+
+/* NOTE: same for the unicast requests confirming a stale entry in use, repeated by arp_cache_timeout() as well */
+static void arp_cache_probe(struct arp_cache *cache) {
+  struct timeval now, interval = {ARP_PROBE_INTERVAL, 0}, expire;
+
+  gettimeofday(&now, NULL);
+  timeradd(&now, &interval, &expire);
+  net_timeout_arm(&cache->timeout, &expire);
+  cache->requests++;
+  stats.probes++;
+}
+
+static void arp_cache_timeout(void *arg) {
+  struct arp_cache *cache;
+  struct net_iface *iface = NULL;
+  ip_addr_t pa = IP_ADDR_ANY;
+  uint8_t ha[ETHER_ADDR_LEN];
+  int probe = 0;
+  struct timeval now, interval = {ARP_FAILED_TIMEOUT, 0}, expire;
+  char addr[IP_ADDR_STR_LEN];
+
+  cache = (struct arp_cache *)arg;
+  mutex_lock(&mutex);
+  /* NOTE: the entry may have been resolved or reused while waiting for the mutex */
+  if (net_timeout_pending(&cache->timeout)) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  switch (cache->state) {
+    case ARP_CACHE_STATE_INCOMPLETE:
+      if (cache->requests < ARP_REQUEST_MAX) {
+        arp_cache_request(cache);
+        iface = cache->iface;
+        pa = cache->pa;
+        break;
+      }
+      debugf("no reply, pa=%s, pending=%u", ip_addr_ntop(cache->pa, addr, sizeof(addr)), cache->pending.num);
+      arp_cache_pending_drop(cache);
+      arp_cache_set_state(cache, ARP_CACHE_STATE_FAILED);
+      gettimeofday(&now, NULL);
+      timeradd(&now, &interval, &expire);
+      net_timeout_arm(&cache->timeout, &expire);
+      stats.failures++;
+      break;
+    case ARP_CACHE_STATE_FAILED:
+      arp_cache_delete(cache);
+      break;
+    case ARP_CACHE_STATE_PROBE:
+      if (cache->requests >= ARP_PROBE_MAX) {
+        debugf("no reply to the probes, pa=%s", ip_addr_ntop(cache->pa, addr, sizeof(addr)));
+        arp_cache_delete(cache);
+        stats.probe_failures++;
+        break;
+      }
+      arp_cache_probe(cache);
+      iface = cache->iface;
+      pa = cache->pa;
+      memcpy(ha, cache->ha, ETHER_ADDR_LEN);
+      probe = 1;
+      break;
+  }
+  mutex_unlock(&mutex);
+  if (iface) {
+    arp_request(iface, pa, probe ? ha : NULL);
+  }
+}
+
 int arp_resolve(struct net_iface *iface, ip_addr_t pa, uint8_t *ha) {
   struct arp_cache *cache;
   char addr1[IP_ADDR_STR_LEN];
@@ -218,22 +506,34 @@ int arp_resolve(struct net_iface *iface, ip_addr_t pa, uint8_t *ha) {
     debugf("unsupported protocol address type");
     return ARP_RESOLVE_ERROR;
   }
+  if (arp_cache_lookup(pa, ha)) {
+    debugf("resolved, pa=%s, ha=%s", ip_addr_ntop(pa, addr1, sizeof(addr1)),
+           ether_addr_ntop(ha, addr2, sizeof(addr2)));
+    return ARP_RESOLVE_FOUND;
+  }
   mutex_lock(&mutex);
   cache = arp_cache_select(pa);
   if (!cache) {
-    cache = arp_cache_alloc();
-    cache->state = ARP_RESOLVE_INCOMPLETE;
-    cache->pa = pa;
-    gettimeofday(&cache->timestamp, NULL);
+    cache = arp_cache_alloc(pa, ARP_CACHE_STATE_INCOMPLETE, NULL);
+    if (!cache) {
+      mutex_unlock(&mutex);
+      errorf("arp_cache_alloc() failure");
+      return ARP_RESOLVE_ERROR;
+    }
+    cache->iface = iface;
+    arp_cache_request(cache);
     mutex_unlock(&mutex);
 
-    arp_request(iface, pa);
+    arp_request(iface, pa, NULL);
     return ARP_RESOLVE_INCOMPLETE;
   }
   if (cache->state == ARP_CACHE_STATE_INCOMPLETE) {
     mutex_unlock(&mutex);
-    arp_request(iface, pa); /* just in case packet loss */
-    return ARP_RESOLVE_INCOMPLETE;
+    return ARP_RESOLVE_INCOMPLETE; /* NOTE: the request is repeated by arp_cache_timeout() */
+  }
+  if (cache->state == ARP_CACHE_STATE_FAILED) {
+    mutex_unlock(&mutex);
+    return ARP_RESOLVE_ERROR;
   }
   memcpy(ha, cache->ha, ETHER_ADDR_LEN);
   mutex_unlock(&mutex);
@@ -241,10 +541,84 @@ int arp_resolve(struct net_iface *iface, ip_addr_t pa, uint8_t *ha) {
   return ARP_RESOLVE_FOUND;
 }
 
-static void arp_input(const uint8_t *data, size_t len, struct net_device *dev) {
+unsigned int arp_stale_generation(void) { return atomic_read(&stale_generation); }
+
+/* NOTE: lock-free as arp_cache_lookup(), which marks the entry as used if it is stale */
+void arp_touch(ip_addr_t pa) {
+  uint8_t ha[ETHER_ADDR_LEN];
+
+  arp_cache_lookup(pa, ha);
+}
+
+/*
+ * holds an IP datagram to pa until its link address is resolved (see arp_resolve()), it is sent at once if it already
+ * is. Up to ARP_PENDING_MAX datagrams are held per target, the oldest one is dropped to make room for a new one.
+ */
+int arp_hold(struct net_iface *iface, ip_addr_t pa, const uint8_t *data, size_t len) {
+  struct arp_cache *cache;
+  struct arp_pending *entry;
+  uint8_t ha[ETHER_ADDR_LEN];
+
+  mutex_lock(&mutex);
+  cache = arp_cache_select(pa);
+  if (!cache || cache->state == ARP_CACHE_STATE_FAILED) {
+    stats.pending_drops++;
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  if (cache->state != ARP_CACHE_STATE_INCOMPLETE) {
+    memcpy(ha, cache->ha, ETHER_ADDR_LEN); /* NOTE: resolved since the caller looked it up */
+    mutex_unlock(&mutex);
+    return net_device_output(iface->dev, ETHER_TYPE_IP, data, len, ha);
+  }
+  if (cache->pending.num >= ARP_PENDING_MAX) {
+    memory_free(queue_pop(&cache->pending));
+    stats.pending_drops++;
+  }
+  entry = memory_alloc(sizeof(*entry) + len);
+  if (!entry) {
+    mutex_unlock(&mutex);
+    errorf("memory_alloc() failure");
+    return -1;
+  }
+  entry->len = len;
+  memcpy(entry->data, data, len);
+  if (!queue_push(&cache->pending, entry)) {
+    memory_free(entry);
+    mutex_unlock(&mutex);
+    errorf("queue_push() failure");
+    return -1;
+  }
+  stats.pending++;
+  mutex_unlock(&mutex);
+  return 0;
+}
+
+/* NOTE: sends the datagrams taken from an entry that has just been resolved, in the order they have been held */
+static void arp_pending_flush(struct net_iface *iface, struct queue_head *pending, const uint8_t *ha) {
+  struct arp_pending *entry;
+  unsigned int num = 0;
+
+  while ((entry = queue_pop(pending)) != NULL) {
+    if (net_device_output(iface->dev, ETHER_TYPE_IP, entry->data, entry->len, ha) != -1) {
+      num++;
+    }
+    memory_free(entry);
+  }
+  if (num) {
+    mutex_lock(&mutex);
+    stats.pending_sent += num;
+    mutex_unlock(&mutex);
+  }
+}
+
+void arp_input(const uint8_t *data, size_t len, struct net_device *dev) {
   struct arp_ether_ip *msg;
   ip_addr_t spa, tpa;
   struct net_iface *iface;
+  struct arp_cache *cache;
+  struct net_iface *pending_iface = NULL;
+  struct queue_head pending;
 
   if (len < sizeof(*msg)) {
     errorf("too short");
@@ -269,17 +643,26 @@ static void arp_input(const uint8_t *data, size_t len, struct net_device *dev) {
   /* try update arp cache */
   int arp_cache_updated = 0;
   mutex_lock(&mutex);
-  if (arp_cache_update(spa, msg->sha)) {
+  cache = arp_cache_update(spa, msg->sha);
+  if (cache) {
     /* updated */
     arp_cache_updated = 1;
+    if (cache->pending.num) {
+      pending = cache->pending; /* NOTE: sent after the mutex is released */
+      queue_init(&cache->pending);
+      pending_iface = cache->iface;
+    }
   }
   mutex_unlock(&mutex);
+  if (pending_iface) {
+    arp_pending_flush(pending_iface, &pending, msg->sha);
+  }
 
   iface = net_device_get_iface(dev, NET_IFACE_FAMILY_IP);
   if (iface && ((struct ip_iface *)iface)->unicast == tpa) {
     if (!arp_cache_updated) {
       mutex_lock(&mutex);
-      arp_cache_insert(spa, msg->sha);
+      arp_cache_insert(iface, spa, msg->sha);
       mutex_unlock(&mutex);
     }
 
@@ -289,30 +672,95 @@ static void arp_input(const uint8_t *data, size_t len, struct net_device *dev) {
   }
 }
 
+/*
+ * Refresh
+ *
+ * NOTE: a reply is trusted for ARP_REACHABLE_TIME, then the entry becomes stale and the senders holding its link
+ * address in a destination cache touch it once. A stale entry keeps being used as it is, the ones touched are
+ * confirmed with unicast requests to the cached address while the others expire quietly, so that the neighbors in use
+ * are refreshed in the background instead of being deleted and resolved with a broadcast from the data path. The
+ * table is swept in slices of ARP_SWEEP_BATCH entries, so that the mutex is never held for a walk of the whole table,
+ * and an entry changes state up to one sweep late.
+ */
+
 static void arp_timer_handler(void) {
   struct arp_cache *entry;
   struct timeval now, diff;
+  struct {
+    struct net_iface *iface;
+    ip_addr_t pa;
+    uint8_t ha[ETHER_ADDR_LEN];
+  } probes[ARP_PROBE_BATCH];
+  int num = 0, stale = 0, n, i;
 
   mutex_lock(&mutex);
   gettimeofday(&now, NULL);
-  for (entry = caches; entry < tailof(caches); entry++) {
-    if (entry->state != ARP_CACHE_STATE_FREE && entry->state != ARP_CACHE_STATE_STATIC) {
-      timersub(&now, &entry->timestamp, &diff);
-      if (diff.tv_sec > ARP_CACHE_TIMEOUT) {
-        arp_cache_delete(entry);
-      }
+  for (n = 0; n < MIN(ARP_SWEEP_BATCH, ARP_CACHE_SIZE); n++) {
+    entry = &caches[sweep];
+    sweep = (sweep + 1) & (ARP_CACHE_SIZE - 1);
+    timersub(&now, &entry->timestamp, &diff);
+    switch (entry->state) {
+      case ARP_CACHE_STATE_REACHABLE:
+        if (diff.tv_sec >= ARP_REACHABLE_TIME) {
+          atomic_write(&entry->used, 0);
+          arp_cache_set_state(entry, ARP_CACHE_STATE_STALE);
+          stale++;
+        }
+        break;
+      case ARP_CACHE_STATE_STALE:
+        if (!atomic_read(&entry->used)) {
+          if (diff.tv_sec >= ARP_REACHABLE_TIME + ARP_STALE_TIMEOUT) {
+            arp_cache_delete(entry);
+          }
+          break;
+        }
+        if (num == ARP_PROBE_BATCH) {
+          break; /* NOTE: probed on a later sweep */
+        }
+        entry->requests = 0;
+        arp_cache_set_state(entry, ARP_CACHE_STATE_PROBE);
+        arp_cache_probe(entry);
+        probes[num].iface = entry->iface;
+        probes[num].pa = entry->pa;
+        memcpy(probes[num].ha, entry->ha, ETHER_ADDR_LEN);
+        num++;
+        break;
     }
   }
   mutex_unlock(&mutex);
+  if (stale) {
+    atomic_inc(&stale_generation); /* NOTE: the link addresses are still valid, the caches are not invalidated */
+  }
+  for (i = 0; i < num; i++) {
+    arp_request(probes[i].iface, probes[i].pa, probes[i].ha);
+  }
+}
+
+void arp_get_stats(struct arp_stats *dst) {
+  mutex_lock(&mutex);
+  *dst = stats;
+  mutex_unlock(&mutex);
 }
 
 int arp_init(void) {
+  struct arp_cache *entry;
+  int i;
+
+  for (i = 0; i < ARP_CACHE_SIZE; i++) {
+    buckets[i] = -1;
+  }
+  for (entry = caches; entry < tailof(caches); entry++) {
+    entry->next = entry + 1 < tailof(caches) ? entry + 1 - caches : -1;
+    entry->older = entry->newer = -1;
+    net_timeout_init(&entry->timeout, arp_cache_timeout, entry);
+  }
+  free_list = 0;
   if (net_protocol_register(NET_PROTOCOL_TYPE_ARP, arp_input) == -1) {
     errorf("net_protocol_register() failure");
     return -1;
   }
 
-  struct timeval interval = {1, 0}; /* 1s */
+  struct timeval interval = {0, ARP_SWEEP_INTERVAL * 1000};
   if (net_timer_register(interval, arp_timer_handler) == -1) {
     errorf("net_timer_register() failure");
     return -1;
@@ -10,7 +10,28 @@
 #define ARP_RESOLVE_INCOMPLETE 0
 #define ARP_RESOLVE_FOUND 1
 
+extern void arp_input(const uint8_t *data, size_t len, struct net_device *dev);
 extern int arp_resolve(struct net_iface *iface, ip_addr_t pa, uint8_t *ha);
+/* for a datagram whose next hop is still incomplete, returns -1 if the next hop has been given up */
+extern int arp_hold(struct net_iface *iface, ip_addr_t pa, const uint8_t *data, size_t len);
+/*
+ * incremented (from 1) each time entries become stale. A sender keeping a resolved link address (see ip_dst_cache)
+ * calls arp_touch() when it has changed, so that the entry is refreshed if in use.
+ */
+extern unsigned int arp_stale_generation(void);
+extern void arp_touch(ip_addr_t pa);
+
+struct arp_stats {
+  uint64_t requests;       /* requests sent */
+  uint64_t failures;       /* targets given up without a reply */
+  uint64_t pending;        /* datagrams held while the link address is resolved */
+  uint64_t pending_sent;   /* held datagrams sent on the reply */
+  uint64_t pending_drops;  /* held datagrams dropped, for the limit or the failure of the target */
+  uint64_t probes;         /* unicast requests sent to confirm a stale entry in use */
+  uint64_t probe_failures; /* entries in use deleted without a reply to the probes */
+};
+
+extern void arp_get_stats(struct arp_stats *stats);
 
 extern int arp_init(void);
 
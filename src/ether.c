@@ -85,6 +85,25 @@ int ether_transmit_helper(struct net_device *dev, uint16_t type, const uint8_t *
   return callback(dev, frame, flen) == (ssize_t)flen ? 0 : -1;
 }
 
+/* NOTE: the header is written in the ETHER_HDR_SIZE bytes in front of data, see net_device_output_inplace() */
+int ether_transmit_inplace_helper(struct net_device *dev, uint16_t type, uint8_t *data, size_t len, const void *dst,
+                                  ether_transmit_func_t callback) {
+  struct ether_hdr *hdr;
+  size_t flen;
+
+  if (len < ETHER_PAYLOAD_SIZE_MIN) {
+    return ether_transmit_helper(dev, type, data, len, dst, callback); /* NOTE: padded in a copy */
+  }
+  hdr = (struct ether_hdr *)(data - sizeof(*hdr));
+  memcpy(hdr->dst, dst, ETHER_ADDR_LEN);
+  memcpy(hdr->src, dev->addr, ETHER_ADDR_LEN);
+  hdr->type = hton16(type);
+  flen = sizeof(*hdr) + len;
+  debugf("dev=%s, type=0x%04x, len=%zu", dev->name, type, flen);
+  ether_dump((uint8_t *)hdr, flen);
+  return callback(dev, (uint8_t *)hdr, flen) == (ssize_t)flen ? 0 : -1;
+}
+
 int ether_input_helper(struct net_device *dev, ether_input_func_t callback) {
   uint8_t frame[ETHER_FRAME_SIZE_MAX];
   ssize_t flen;
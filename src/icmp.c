@@ -3,12 +3,24 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "ip.h"
+#include "platform.h"
 #include "util.h"
 
 #define ICMP_BUFSIZ IP_PAYLOAD_SIZE_MAX
 
+/* NOTE: same defaults as Linux (net.ipv4.icmp_msgs_per_sec/icmp_msgs_burst), may be overridden from CFLAGS */
+#ifndef ICMP_RATE_LIMIT
+#define ICMP_RATE_LIMIT 1000 /* messages per second */
+#endif
+#ifndef ICMP_RATE_BURST
+#define ICMP_RATE_BURST 50 /* messages sent at once after a quiet period */
+#endif
+
+#define ICMP_RATE_COST (1000000 / ICMP_RATE_LIMIT) /* microseconds of credit per message */
+
 struct icmp_hdr {
   uint8_t type;
   uint8_t code;
@@ -24,6 +36,13 @@ struct icmp_echo {
   uint16_t seq;
 };
 
+static mutex_t mutex = MUTEX_INITIALIZER; /* for the bucket and the stats */
+static struct {
+  uint64_t credit; /* microseconds */
+  struct timeval last;
+} bucket;
+static struct icmp_stats stats;
+
 static char *icmp_type_ntoa(uint8_t type) {
   switch (type) {
     case ICMP_TYPE_ECHOREPLY:
@@ -78,6 +97,67 @@ static void icmp_dump(const uint8_t *data, size_t len) {
   funlockfile(stderr);
 }
 
+/*
+ * Rate Limiting
+ *
+ * NOTE: every message generated, replies and errors alike, takes a token from a single bucket refilled at
+ * ICMP_RATE_LIMIT per second, so that a flood of requests or of datagrams in error does not turn into a flood of ICMP.
+ * The credit is counted in microseconds, a token is ICMP_RATE_COST of it.
+ */
+
+/* NOTE: must be called after mutex locked, returns 0 if the message must not be sent */
+static int icmp_rate_allow(void) {
+  struct timeval now, diff;
+  uint64_t elapsed;
+
+  gettimeofday(&now, NULL);
+  timersub(&now, &bucket.last, &diff);
+  bucket.last = now;
+  elapsed = diff.tv_sec < 0 ? 0 : (uint64_t)diff.tv_sec * 1000000 + diff.tv_usec; /* NOTE: the clock may go back */
+  bucket.credit = MIN(bucket.credit + elapsed, (uint64_t)ICMP_RATE_COST * ICMP_RATE_BURST);
+  if (bucket.credit < ICMP_RATE_COST) {
+    stats.rate_limited++;
+    return 0;
+  }
+  bucket.credit -= ICMP_RATE_COST;
+  return 1;
+}
+
+/* turns an Echo into its reply in place, see ip_protocol_register_reflect() */
+static int icmp_reflect(uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
+  struct icmp_hdr *hdr;
+  uint32_t sum;
+  int allow;
+  char addr1[IP_ADDR_STR_LEN];
+  char addr2[IP_ADDR_STR_LEN];
+
+  hdr = (struct icmp_hdr *)data;
+  if (len < ICMP_HDR_SIZE || hdr->type != ICMP_TYPE_ECHO) {
+    return 0;
+  }
+  if (cksum16((uint16_t *)data, len, 0) != 0) {
+    return 0; /* NOTE: reported by icmp_input() */
+  }
+  mutex_lock(&mutex);
+  allow = icmp_rate_allow();
+  if (allow) {
+    stats.echo_replies++;
+    stats.reflected++;
+  }
+  mutex_unlock(&mutex);
+  if (!allow) {
+    return -1;
+  }
+  /* NOTE: the reply differs only in the type, the checksum is patched rather than computed again (rfc1624) */
+  hdr->type = ICMP_TYPE_ECHOREPLY;
+  sum = hdr->sum + hton16(ICMP_TYPE_ECHO << 8);
+  hdr->sum = sum + (sum >= 0xffff);
+
+  debugf("%s => %s, len=%zu", ip_addr_ntop(dst, addr1, sizeof(addr1)), ip_addr_ntop(src, addr2, sizeof(addr2)), len);
+  icmp_dump(data, len);
+  return 1;
+}
+
 void icmp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
   char addr1[IP_ADDR_STR_LEN];
   char addr2[IP_ADDR_STR_LEN];
@@ -103,6 +183,13 @@ void icmp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, s
       icmp_output(ICMP_TYPE_ECHOREPLY, hdr->code, hdr->values, (uint8_t *)hdr + ICMP_HDR_SIZE, len - ICMP_HDR_SIZE,
                   iface->unicast, src);
       break;
+    case ICMP_TYPE_DEST_UNREACH:
+    case ICMP_TYPE_SOURCE_QUENCH:
+    case ICMP_TYPE_TIME_EXCEEDED:
+    case ICMP_TYPE_PARAM_PROBLEM:
+      /* the header and the leading bytes of the datagram that caused the error follow the ICMP header */
+      ip_error_input(hdr->type, hdr->code, ntoh32(hdr->values), (uint8_t *)hdr + ICMP_HDR_SIZE, len - ICMP_HDR_SIZE);
+      break;
     default:
       /* ignore */
       break;
@@ -114,9 +201,25 @@ int icmp_output(uint8_t type, uint8_t code, uint32_t values, const uint8_t *data
   uint8_t buf[ICMP_BUFSIZ];
   struct icmp_hdr *hdr;
   size_t msg_len;
+  int allow;
   char addr1[IP_ADDR_STR_LEN];
   char addr2[IP_ADDR_STR_LEN];
 
+  mutex_lock(&mutex);
+  allow = icmp_rate_allow();
+  if (allow) {
+    if (type == ICMP_TYPE_ECHOREPLY) {
+      stats.echo_replies++;
+    } else {
+      stats.errors++;
+    }
+  }
+  mutex_unlock(&mutex);
+  if (!allow) {
+    debugf("rate limited, type=%u (%s)", type, icmp_type_ntoa(type));
+    return 0;
+  }
+
   hdr = (struct icmp_hdr *)buf;
   hdr->type = type;
   hdr->code = code;
@@ -133,10 +236,20 @@ int icmp_output(uint8_t type, uint8_t code, uint32_t values, const uint8_t *data
   return ip_output(IP_PROTOCOL_ICMP, buf, msg_len, src, dst);
 }
 
+void icmp_get_stats(struct icmp_stats *dst) {
+  mutex_lock(&mutex);
+  *dst = stats;
+  mutex_unlock(&mutex);
+}
+
 int icmp_init(void) {
   if (ip_protocol_register(IP_PROTOCOL_ICMP, icmp_input) == -1) {
     errorf("ip_protocol_register() failure");
     return -1;
   }
+  if (ip_protocol_register_reflect(IP_PROTOCOL_ICMP, icmp_reflect) == -1) {
+    errorf("ip_protocol_register_reflect() failure");
+    return -1;
+  }
   return 0;
 }
\ No newline at end of file
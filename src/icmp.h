@@ -20,9 +20,31 @@
 #define ICMP_TYPE_INFO_REQUEST 15
 #define ICMP_TYPE_INFO_REPLY 16
 
+/* codes of Destination Unreachable */
+#define ICMP_CODE_NET_UNREACH 0
+#define ICMP_CODE_HOST_UNREACH 1
+#define ICMP_CODE_PROTO_UNREACH 2
+#define ICMP_CODE_PORT_UNREACH 3
+#define ICMP_CODE_FRAG_NEEDED 4
+#define ICMP_CODE_SOURCE_ROUTE_FAILED 5
+
+/* codes of Time Exceeded */
+#define ICMP_CODE_EXCEEDED_TTL 0
+#define ICMP_CODE_EXCEEDED_FRAGMENT 1
+
+extern void icmp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface);
 extern int icmp_output(uint8_t type, uint8_t code, uint32_t values, const uint8_t *data, size_t len, ip_addr_t src,
                        ip_addr_t dst);
 
+struct icmp_stats {
+  uint64_t echo_replies; /* Echo Replies sent */
+  uint64_t reflected;    /* of the above, turned around in the buffer of the request */
+  uint64_t errors;       /* error messages sent */
+  uint64_t rate_limited; /* messages not sent for exceeding ICMP_RATE_LIMIT */
+};
+
+extern void icmp_get_stats(struct icmp_stats *stats);
+
 extern int icmp_init(void);
 
 #endif
\ No newline at end of file
@@ -8,10 +8,32 @@
 #include <sys/types.h>
 
 #include "arp.h"
+#include "icmp.h"
 #include "net.h"
 #include "platform.h"
+#include "tcp.h"
+#include "udp.h"
 #include "util.h"
 
+#define IP_HDR_FLAG_DF 0x4000 /* don't fragment */
+#define IP_HDR_FLAG_MF 0x2000 /* more fragments */
+#define IP_HDR_OFFSET_MASK 0x1fff
+
+#define IP_REASS_NUM 16                  /* datagrams reassembled at the same time */
+#define IP_REASS_HOLES_MAX 16            /* per datagram */
+#define IP_REASS_MEM_MAX (256 * 1024)    /* bytes, of the fragments held by all the reassemblies as received */
+#define IP_REASS_TIMEOUT 30              /* seconds, same as Linux (ipfrag_time) */
+#define IP_REASS_INFINITY ((uint32_t)-1) /* last byte of the hole after the last fragment received */
+
+#define IP_FWD_BATCH_SIZE 32 /* forwarded datagrams held per egress device */
+#define IP_FWD_DEVICES 8
+
+#define IP_ADDR_IS_MULTICAST(x) ((ntoh32(x) & 0xf0000000) == 0xe0000000) /* 224.0.0.0/4 */
+
+#define IP_PMTU_CACHE_SIZE 64
+#define IP_PMTU_TIMEOUT 600 /* seconds, see rfc1191 section 6.3 */
+#define IP_PMTU_MIN 552     /* floor of a learned MTU, same as min_pmtu of Linux */
+
 struct ip_hdr {
   uint8_t vhl;
   uint8_t tos;
@@ -26,28 +48,121 @@ struct ip_hdr {
   uint8_t options[];
 };
 
+/* NOTE: indexed by the protocol number, the entry is unused if handler is NULL */
 struct ip_protocol {
-  struct ip_protocol *next;
-  uint8_t type;
   void (*handler)(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface);
+  int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data, size_t dlen, ip_addr_t src, ip_addr_t dst,
+             unsigned int count);
+  void (*err)(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, uint8_t type, uint8_t code, uint32_t info);
+  int (*reflect)(uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface);
+};
+
+/* path MTU learned from Fragmentation Needed, see https://tools.ietf.org/html/rfc1191 */
+struct ip_pmtu {
+  int used;
+  ip_addr_t addr;
+  uint16_t mtu;
+  struct timeval timestamp;
+};
+
+/* fragment held in the buffer it has been received in until the datagram is complete, see net_input_release() */
+struct ip_frag {
+  struct ip_frag *next;
+  uint8_t *buf;        /* the received datagram */
+  const uint8_t *data; /* the payload, in buf */
+  uint16_t offset;     /* bytes */
+  uint16_t len;
+};
+
+struct ip_hole {
+  uint32_t first;
+  uint32_t last; /* inclusive */
+};
+
+/* datagram being reassembled, see https://tools.ietf.org/html/rfc815 */
+struct ip_reass {
+  int used;
+  ip_addr_t src;
+  ip_addr_t dst;
+  uint16_t id;
+  uint8_t protocol;
+  struct ip_iface *iface;
+  uint32_t len; /* payload length, 0 until the last fragment arrives */
+  struct ip_hole holes[IP_REASS_HOLES_MAX];
+  int num;
+  struct ip_frag *frags;
+  size_t mem; /* bytes of the datagrams held by frags */
+  struct timeval first;
+  struct net_timeout timeout; /* drops the datagram still incomplete */
+};
+
+/* forwarded datagrams toward a device, passed to it at the end of the batch of the softirq */
+struct ip_fwd_batch {
+  struct ip_iface *iface; /* NULL if unused */
+  unsigned int gen;       /* of the link address below, see ip_dst_cache_invalidate() */
+  unsigned int stale;     /* see arp_stale_generation(), looked up again to mark the next hop as used */
+  ip_addr_t nexthop;
+  uint8_t hwaddr[NET_DEVICE_ADDR_LEN]; /* reused while the datagrams go to the same next hop */
+  int num;
+  struct {
+    uint8_t *data; /* buffer of the softirq, as received */
+    size_t len;
+    uint8_t hwaddr[NET_DEVICE_ADDR_LEN];
+    int local; /* reflected back to its source, not counted as forwarded */
+  } pkts[IP_FWD_BATCH_SIZE];
 };
 
 struct ip_route {
   struct ip_route *next;
   ip_addr_t network;
   ip_addr_t netmask;
+  int prefixlen;
   ip_addr_t nexthop;
   struct ip_iface *iface;
 };
 
+/*
+ * Routing table: a multibit trie with strides of 16, 8 and 8 bits (DIR-16-8-8). Prefixes are expanded so that every
+ * slot holds the longest one covering it, a lookup takes at most 3 memory accesses.
+ */
+
+#define IP_LPM_ROOT_BITS 16
+#define IP_LPM_CHUNK_BITS 8
+#define IP_LPM_LEAF 0x1 /* tag of a slot pointing to a route, a slot pointing to a chunk below is untagged */
+
+struct ip_lpm_chunk {
+  uintptr_t slots[1 << IP_LPM_CHUNK_BITS];
+};
+
 const ip_addr_t IP_ADDR_ANY = 0x00000000;       /* 0.0.0.0 */
 const ip_addr_t IP_ADDR_BROADCAST = 0xffffffff; /* 255.255.255.255 */
 
 /* NOTE: if you want to add/delete the entries after net_run(), you need to protect these lists with a mutex. */
 static struct ip_iface *ifaces;
-static struct ip_protocol *protocols;
+static struct ip_protocol protocols[UINT8_MAX + 1];
 static struct ip_route *routes;
 
+/*
+ * NOTE: the routes are added in place under route_mutex, while the lookups take no lock. A slot is updated with
+ * a single store and a chunk is filled before being published, a lookup sees either the old or the new route.
+ */
+static mutex_t route_mutex = MUTEX_INITIALIZER;
+static uintptr_t lpm_root[1 << IP_LPM_ROOT_BITS];
+static size_t lpm_chunks;
+
+static unsigned int dst_generation = 1; /* see ip_dst_cache_invalidate() */
+
+static mutex_t mutex = MUTEX_INITIALIZER; /* for the reassemblies, the path MTUs and the stats */
+static struct ip_reass reasses[IP_REASS_NUM];
+static struct ip_pmtu pmtus[IP_PMTU_CACHE_SIZE];
+static size_t reass_mem;
+static struct ip_stats stats;
+
+static int forwarding; /* see ip_set_forwarding() */
+/* NOTE: used only by the softirq, the counters are added to stats at the end of each batch */
+static struct ip_fwd_batch fwd_batches[IP_FWD_DEVICES];
+static struct ip_stats fwd_stats;
+
 int ip_addr_pton(const char *p, ip_addr_t *n) {
   char *sp, *ep;
   int idx;
@@ -138,26 +253,137 @@ static void ip_dump(const uint8_t *data, size_t len) {
   funlockfile(stderr);
 }
 
-/* NOTE: must not be call after net_run() */
-static struct ip_route *ip_route_add(ip_addr_t network, ip_addr_t netmask, ip_addr_t nexthop, struct ip_iface *iface) {
-  char addr1[IP_ADDR_STR_LEN];
-  char addr2[IP_ADDR_STR_LEN];
-  char addr3[IP_ADDR_STR_LEN];
-  char addr4[IP_ADDR_STR_LEN];
+static struct ip_route *ip_lpm_route(uintptr_t slot) {
+  return (slot & IP_LPM_LEAF) ? (struct ip_route *)(slot & ~(uintptr_t)IP_LPM_LEAF) : NULL;
+}
+
+static struct ip_lpm_chunk *ip_lpm_chunk(uintptr_t slot) {
+  return (slot && !(slot & IP_LPM_LEAF)) ? (struct ip_lpm_chunk *)slot : NULL;
+}
+
+/* sets the route to the slots not taken by a longer prefix, including the slots of the chunks below */
+static void ip_lpm_fill(uintptr_t *slots, size_t num, struct ip_route *route) {
+  struct ip_lpm_chunk *chunk;
+  struct ip_route *current;
+  size_t i;
+
+  for (i = 0; i < num; i++) {
+    chunk = ip_lpm_chunk(slots[i]);
+    if (chunk) {
+      ip_lpm_fill(chunk->slots, countof(chunk->slots), route);
+      continue;
+    }
+    current = ip_lpm_route(slots[i]);
+    if (!current || current->prefixlen <= route->prefixlen) {
+      atomic_write_ptr(&slots[i], (uintptr_t)route | IP_LPM_LEAF);
+    }
+  }
+}
+
+/* returns the chunk below the slot, the route of the slot is pushed down to all the slots of a new chunk */
+static struct ip_lpm_chunk *ip_lpm_expand(uintptr_t *slot) {
+  struct ip_lpm_chunk *chunk;
+  size_t i;
+
+  chunk = ip_lpm_chunk(*slot);
+  if (chunk) {
+    return chunk;
+  }
+  chunk = memory_alloc(sizeof(*chunk));
+  if (!chunk) {
+    errorf("memory_alloc() failure");
+    return NULL;
+  }
+  for (i = 0; i < countof(chunk->slots); i++) {
+    chunk->slots[i] = *slot;
+  }
+  atomic_write_ptr(slot, (uintptr_t)chunk); /* NOTE: published once filled */
+  lpm_chunks++;
+  return chunk;
+}
+
+/* NOTE: must be called after route_mutex locked */
+static int ip_lpm_insert(struct ip_route *route) {
+  uint32_t network;
+  uintptr_t *slots = lpm_root;
+  struct ip_lpm_chunk *chunk;
+  int bits = IP_LPM_ROOT_BITS, shift = 32 - IP_LPM_ROOT_BITS;
+
+  network = ntoh32(route->network);
+  /* descend to the level where the prefix ends, 32 - shift bits are resolved at each level */
+  while (route->prefixlen > 32 - shift) {
+    chunk = ip_lpm_expand(&slots[(network >> shift) & ((1 << bits) - 1)]);
+    if (!chunk) {
+      return -1;
+    }
+    slots = chunk->slots;
+    bits = IP_LPM_CHUNK_BITS;
+    shift -= IP_LPM_CHUNK_BITS;
+  }
+  ip_lpm_fill(&slots[(network >> shift) & ((1 << bits) - 1)], (size_t)1 << (32 - shift - route->prefixlen), route);
+  return 0;
+}
+
+static int ip_netmask_prefixlen(ip_addr_t netmask) {
+  uint32_t host = ~ntoh32(netmask);
+  int len = 32;
+
+  if (host & (host + 1)) {
+    return -1; /* not contiguous */
+  }
+  for (; host; host >>= 1) {
+    len--;
+  }
+  return len;
+}
 
+static struct ip_route *ip_route_insert(ip_addr_t network, ip_addr_t netmask, ip_addr_t nexthop,
+                                        struct ip_iface *iface) {
   struct ip_route *route;
+  int prefixlen;
+
+  prefixlen = ip_netmask_prefixlen(netmask);
+  if (prefixlen == -1) {
+    errorf("invalid netmask");
+    return NULL;
+  }
   route = memory_alloc(sizeof(*route));
   if (!route) {
     errorf("memory_alloc() failure");
     return NULL;
   }
-  route->network = network;
+  route->network = network & netmask;
   route->netmask = netmask;
+  route->prefixlen = prefixlen;
   route->nexthop = nexthop;
   route->iface = iface;
 
+  mutex_lock(&route_mutex);
+  if (ip_lpm_insert(route) == -1) {
+    errorf("ip_lpm_insert() failure");
+    mutex_unlock(&route_mutex);
+    memory_free(route); /* NOTE: not referred yet, the slots are set only after the chunks are allocated */
+    return NULL;
+  }
   route->next = routes;
   routes = route;
+  mutex_unlock(&route_mutex);
+  ip_dst_cache_invalidate();
+  return route;
+}
+
+static struct ip_route *ip_route_add(ip_addr_t network, ip_addr_t netmask, ip_addr_t nexthop, struct ip_iface *iface) {
+  char addr1[IP_ADDR_STR_LEN];
+  char addr2[IP_ADDR_STR_LEN];
+  char addr3[IP_ADDR_STR_LEN];
+  char addr4[IP_ADDR_STR_LEN];
+
+  struct ip_route *route;
+  route = ip_route_insert(network, netmask, nexthop, iface);
+  if (!route) {
+    errorf("ip_route_insert() failure");
+    return NULL;
+  }
 
   infof("route added: network=%s, netmask=%s, nexthop=%s, iface=%s dev=%s",
         ip_addr_ntop(route->network, addr1, sizeof(addr1)), ip_addr_ntop(route->netmask, addr2, sizeof(addr2)),
@@ -167,8 +393,25 @@ static struct ip_route *ip_route_add(ip_addr_t network, ip_addr_t netmask, ip_ad
 }
 
 static struct ip_route *ip_route_lookup(ip_addr_t dst) {
+  uint32_t addr;
+  uintptr_t slot;
+  struct ip_lpm_chunk *chunk;
+  int shift = 32 - IP_LPM_ROOT_BITS;
+
+  addr = ntoh32(dst);
+  slot = atomic_read_ptr(&lpm_root[addr >> shift]);
+  while ((chunk = ip_lpm_chunk(slot)) != NULL) {
+    shift -= IP_LPM_CHUNK_BITS;
+    slot = atomic_read_ptr(&chunk->slots[(addr >> shift) & ((1 << IP_LPM_CHUNK_BITS) - 1)]);
+  }
+  return ip_lpm_route(slot);
+}
+
+/* NOTE: the search through the list that the table replaced, for comparison */
+static struct ip_route *ip_route_lookup_linear(ip_addr_t dst) {
   struct ip_route *route, *candidate = NULL;
 
+  mutex_lock(&route_mutex);
   for (route = routes; route; route = route->next) {
     if ((dst & route->netmask) == route->network) {
       if (!candidate || ntoh32(candidate->netmask) < ntoh32(route->netmask)) {
@@ -176,6 +419,7 @@ static struct ip_route *ip_route_lookup(ip_addr_t dst) {
       }
     }
   }
+  mutex_unlock(&route_mutex);
 
   return candidate;
 }
@@ -195,6 +439,15 @@ int ip_route_set_default_gateway(struct ip_iface *iface, const char *gateway) {
   return 0;
 }
 
+/* NOTE: silent, meant for loading a full routing table, even after net_run() */
+int ip_route_add_prefix(ip_addr_t network, ip_addr_t netmask, ip_addr_t nexthop, struct ip_iface *iface) {
+  if (!ip_route_insert(network, netmask, nexthop, iface)) {
+    errorf("ip_route_insert() failure");
+    return -1;
+  }
+  return 0;
+}
+
 struct ip_iface *ip_route_get_iface(ip_addr_t dst) {
   struct ip_route *route;
 
@@ -205,6 +458,25 @@ struct ip_iface *ip_route_get_iface(ip_addr_t dst) {
   return route->iface;
 }
 
+struct ip_iface *ip_route_get_iface_linear(ip_addr_t dst) {
+  struct ip_route *route;
+
+  route = ip_route_lookup_linear(dst);
+  if (!route) {
+    return NULL;
+  }
+  return route->iface;
+}
+
+size_t ip_route_table_chunks(void) {
+  size_t num;
+
+  mutex_lock(&route_mutex);
+  num = lpm_chunks;
+  mutex_unlock(&route_mutex);
+  return num;
+}
+
 struct ip_iface *ip_iface_alloc(const char *unicast, const char *netmask) {
   struct ip_iface *iface;
 
@@ -274,194 +546,1253 @@ struct ip_iface *ip_iface_select(ip_addr_t addr) {
 int ip_protocol_register(uint8_t type, void (*handler)(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
                                                        struct ip_iface *iface)) {
   struct ip_protocol *entry;
-  for (entry = protocols; entry; entry = entry->next) {
-    if (entry->type == type) {
-      errorf("ip_protocol_register: already registerd: type=%x", type);
-      return -1;
-    }
-  }
 
-  entry = memory_alloc(sizeof(*entry));
-  if (!entry) {
-    errorf("memory_alloc() failure");
+  entry = &protocols[type];
+  if (entry->handler) {
+    errorf("ip_protocol_register: already registerd: type=%x", type);
     return -1;
   }
-  entry->type = type;
   entry->handler = handler;
-  entry->next = protocols;
-  protocols = entry;
-  infof("registered, type=%u", entry->type);
+  infof("registered, type=%u", type);
 
   return 0;
 }
 
-static void ip_input(const uint8_t *data, size_t len, struct net_device *dev) {
-  struct ip_hdr *hdr;
-  uint8_t v;
-  uint16_t hlen, total, offset;
+int ip_protocol_register_gro(uint8_t type, int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data,
+                                                      size_t dlen, ip_addr_t src, ip_addr_t dst, unsigned int count)) {
+  struct ip_protocol *entry;
 
-  if (len < IP_HDR_SIZE_MIN) {
-    errorf("too short");
-    return;
+  entry = &protocols[type];
+  if (!entry->handler) {
+    errorf("not registered, type=%u", type);
+    return -1;
   }
-  hdr = (struct ip_hdr *)data;
+  entry->gro = gro;
+  infof("registered, type=%u", type);
+  return 0;
+}
 
-  v = hdr->vhl >> 4;
-  if (v != IP_VERSION_IPV4) {
-    errorf("ip version error: v=%u", v);
-    return;
-  }
+int ip_protocol_register_err(uint8_t type, void (*err)(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
+                                                       uint8_t type, uint8_t code, uint32_t info)) {
+  struct ip_protocol *entry;
 
-  hlen = (hdr->vhl & 0x0f) << 2;
-  if (len < hlen) {
-    errorf("header length error: len=%zu < hlen=%u", len, hlen);
-    return;
+  entry = &protocols[type];
+  if (!entry->handler) {
+    errorf("not registered, type=%u", type);
+    return -1;
   }
+  entry->err = err;
+  infof("registered, type=%u", type);
+  return 0;
+}
 
-  total = ntoh16(hdr->total);
-  if (len < total) {
-    errorf("total length error: len=%zu < total=%u", len, total);
-    return;
+int ip_protocol_register_reflect(uint8_t type, int (*reflect)(uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
+                                                               struct ip_iface *iface)) {
+  struct ip_protocol *entry;
+
+  entry = &protocols[type];
+  if (!entry->handler) {
+    errorf("not registered, type=%u", type);
+    return -1;
   }
+  entry->reflect = reflect;
+  infof("registered, type=%u", type);
+  return 0;
+}
 
-  if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
-    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
-           ntoh16(cksum16((uint16_t *)hdr, hlen, -hdr->sum)));
-    return;
+/* NOTE: only the datagrams of a protocol with a GRO handler are held, see ip_gro_receive() */
+static int ip_gro_hold(const uint8_t *data, size_t len) {
+  const struct ip_hdr *hdr;
+
+  hdr = (const struct ip_hdr *)data;
+  if (len < IP_HDR_SIZE_MIN || hdr->vhl != ((IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2))) {
+    return 0;
   }
+  if (ntoh16(hdr->offset) & 0x3fff) {
+    return 0; /* fragments */
+  }
+  return protocols[hdr->protocol].gro != NULL;
+}
 
-  offset = ntoh16(hdr->offset);
-  if (offset & 0x2000 || offset & 0x1fff) {
-    errorf("fragments does not support");
-    return;
+/* NOTE: only datagrams without options and fragmentation are merged, the header of held is rewritten */
+static int ip_gro_receive(uint8_t *held, size_t *len, size_t size, const uint8_t *data, size_t dlen,
+                          unsigned int count) {
+  struct ip_hdr *hdr1, *hdr2;
+  struct ip_protocol *protocol;
+  uint16_t total1, total2;
+  size_t plen;
+
+  hdr1 = (struct ip_hdr *)held;
+  hdr2 = (struct ip_hdr *)data;
+  if (*len < IP_HDR_SIZE_MIN || dlen < IP_HDR_SIZE_MIN) {
+    return 0;
+  }
+  if (hdr1->vhl != ((IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2)) || hdr2->vhl != hdr1->vhl) {
+    return 0;
+  }
+  total1 = ntoh16(hdr1->total);
+  total2 = ntoh16(hdr2->total);
+  if (total1 < IP_HDR_SIZE_MIN || total1 > *len || total2 < IP_HDR_SIZE_MIN || total2 > dlen) {
+    return 0;
+  }
+  if (hdr1->src != hdr2->src || hdr1->dst != hdr2->dst || hdr1->protocol != hdr2->protocol || hdr1->tos != hdr2->tos ||
+      hdr1->ttl != hdr2->ttl) {
+    return 0;
+  }
+  if ((ntoh16(hdr1->offset) | ntoh16(hdr2->offset)) & 0x3fff) {
+    return 0; /* fragments */
   }
+  if ((count == 1 && cksum16((uint16_t *)hdr1, IP_HDR_SIZE_MIN, 0) != 0) ||
+      cksum16((uint16_t *)hdr2, IP_HDR_SIZE_MIN, 0) != 0) {
+    return 0;
+  }
+  protocol = &protocols[hdr1->protocol];
+  if (!protocol->gro) {
+    return 0;
+  }
+  plen = total1 - IP_HDR_SIZE_MIN;
+  if (!protocol->gro(held + IP_HDR_SIZE_MIN, &plen, size - IP_HDR_SIZE_MIN, data + IP_HDR_SIZE_MIN,
+                     total2 - IP_HDR_SIZE_MIN, hdr1->src, hdr1->dst, count)) {
+    return 0;
+  }
+  hdr1->total = hton16(IP_HDR_SIZE_MIN + plen);
+  hdr1->sum = 0;
+  hdr1->sum = cksum16((uint16_t *)hdr1, IP_HDR_SIZE_MIN, 0);
+  *len = IP_HDR_SIZE_MIN + plen;
+  return 1;
+}
 
-  struct ip_iface *iface;
-  iface = (struct ip_iface *)net_device_get_iface(dev, NET_IFACE_FAMILY_IP);
-  if (!iface) {
-    /* no iface on the device */
-    return;
+static void ip_input_deliver(uint8_t type, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
+                             struct ip_iface *iface) {
+#ifdef NET_STATIC_DISPATCH
+  /* NOTE: direct calls so that the compiler can inline the common path, see net.h */
+  switch (type) {
+    case IP_PROTOCOL_TCP:
+      tcp_input(data, len, src, dst, iface);
+      return;
+    case IP_PROTOCOL_UDP:
+      udp_input(data, len, src, dst, iface);
+      return;
+    case IP_PROTOCOL_ICMP:
+      icmp_input(data, len, src, dst, iface);
+      return;
   }
+#endif
+  if (protocols[type].handler) {
+    protocols[type].handler(data, len, src, dst, iface);
+  }
+  /* unsupported protocol */
+}
 
-  if (hdr->dst != iface->unicast && hdr->dst != IP_ADDR_BROADCAST && hdr->dst != iface->broadcast) {
-    /* for other device */
-    return;
+/*
+ * Reassembly
+ *
+ * NOTE: a fragment is taken by ip_early_input() and kept in the buffer it has been received in, its payload is copied
+ * once, when the hole list is empty and the datagram is put together. Overlapping fragments discard the whole
+ * datagram, same as Linux (see CVE-2018-5391).
+ */
+
+static void ip_reass_timeout(void *arg);
+
+/* NOTE: must be called after mutex locked */
+static void ip_reass_free(struct ip_reass *reass) {
+  struct ip_frag *frag;
+
+  while ((frag = reass->frags) != NULL) {
+    reass->frags = frag->next;
+    net_input_release(frag->buf);
+    memory_free(frag);
   }
+  reass_mem -= reass->mem;
+  net_timeout_cancel(&reass->timeout);
+  memset(reass, 0, sizeof(*reass));
+}
 
-  char addr[IP_ADDR_STR_LEN];
-  debugf("dev=%s, iface=%s, protocol=%u, total=%u", dev->name, ip_addr_ntop(iface->unicast, addr, sizeof(addr)),
-         hdr->protocol, total);
-  ip_dump(data, total);
+/* NOTE: must be called after mutex locked */
+static struct ip_reass *ip_reass_select(const struct ip_hdr *hdr, struct ip_iface *iface) {
+  struct ip_reass *reass, *free = NULL, *oldest = NULL;
+  struct timeval expire;
 
-  struct ip_protocol *protocol;
-  for (protocol = protocols; protocol; protocol = protocol->next) {
-    if (protocol->type == hdr->protocol) {
-      protocol->handler((uint8_t *)hdr + hlen, total - hlen, hdr->src, hdr->dst, iface);
-      return;
+  for (reass = reasses; reass < tailof(reasses); reass++) {
+    if (!reass->used) {
+      free = free ? free : reass;
+      continue;
+    }
+    if (reass->src == hdr->src && reass->dst == hdr->dst && reass->id == hdr->id &&
+        reass->protocol == hdr->protocol) {
+      return reass;
+    }
+    if (!oldest || timercmp(&reass->first, &oldest->first, <)) {
+      oldest = reass;
     }
   }
-  /* unsupported protocol */
+  if (!free) {
+    stats.reass_drops++;
+    ip_reass_free(oldest);
+    free = oldest;
+  }
+  reass = free;
+  reass->used = 1;
+  reass->src = hdr->src;
+  reass->dst = hdr->dst;
+  reass->id = hdr->id;
+  reass->protocol = hdr->protocol;
+  reass->iface = iface;
+  reass->holes[0].first = 0;
+  reass->holes[0].last = IP_REASS_INFINITY;
+  reass->num = 1;
+  gettimeofday(&reass->first, NULL);
+  net_timeout_init(&reass->timeout, ip_reass_timeout, reass);
+  expire = reass->first;
+  expire.tv_sec += IP_REASS_TIMEOUT;
+  net_timeout_arm(&reass->timeout, &expire);
+  return reass;
 }
 
-static int ip_output_device(struct ip_iface *iface, const uint8_t *data, size_t len, ip_addr_t dst) {
-  uint8_t hwaddr[NET_DEVICE_ADDR_LEN] = {};
+/* NOTE: makes room under the memory cap by dropping the oldest other datagrams, must be called after mutex locked */
+static int ip_reass_reserve(struct ip_reass *current, size_t len) {
+  struct ip_reass *reass, *oldest;
 
-  if (NET_IFACE(iface)->dev->flags & NET_DEVICE_FLAG_NEED_ARP) {
-    if (dst == iface->broadcast || dst == IP_ADDR_BROADCAST) {
-      memcpy(hwaddr, NET_IFACE(iface)->dev->broadcast, NET_IFACE(iface)->dev->alen);
-    } else {
-      int ret = arp_resolve(NET_IFACE(iface), dst, hwaddr);
-      if (ret != ARP_RESOLVE_FOUND) {
-        return ret;
+  while (reass_mem + len > IP_REASS_MEM_MAX) {
+    oldest = NULL;
+    for (reass = reasses; reass < tailof(reasses); reass++) {
+      if (reass->used && reass != current && (!oldest || timercmp(&reass->first, &oldest->first, <))) {
+        oldest = reass;
       }
     }
+    if (!oldest) {
+      return -1;
+    }
+    stats.reass_drops++;
+    ip_reass_free(oldest);
   }
+  return 0;
+}
 
-  return net_device_output(NET_IFACE(iface)->dev, NET_PROTOCOL_TYPE_IP, data, len, hwaddr);
+/*
+ * fills the hole the fragment [first, last] falls in, see https://tools.ietf.org/html/rfc815#section-3
+ * returns 1 if filled, 0 for a duplicate, -1 if the fragment overlaps data or does not match the datagram
+ */
+static int ip_reass_fill(struct ip_reass *reass, uint32_t first, uint32_t last, int more) {
+  struct ip_hole *hole;
+  int i;
+
+  for (i = 0; i < reass->num; i++) {
+    hole = &reass->holes[i];
+    if (first > hole->last || last < hole->first) {
+      continue;
+    }
+    if (first < hole->first || last > hole->last || (!more && hole->last != IP_REASS_INFINITY)) {
+      return -1;
+    }
+    if (first > hole->first && last < hole->last && more) {
+      if (reass->num == IP_REASS_HOLES_MAX) {
+        return -1;
+      }
+      reass->holes[reass->num].first = last + 1;
+      reass->holes[reass->num].last = hole->last;
+      reass->num++;
+      hole->last = first - 1;
+    } else if (first > hole->first) {
+      hole->last = first - 1;
+    } else if (last < hole->last && more) {
+      hole->first = last + 1;
+    } else {
+      *hole = reass->holes[--reass->num];
+    }
+    if (!more) {
+      reass->len = last + 1;
+    }
+    return 1;
+  }
+  return reass->len && last >= reass->len ? -1 : 0;
 }
 
-static ssize_t ip_output_core(struct ip_iface *iface, uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src,
-                              ip_addr_t dst, ip_addr_t nexthop, uint16_t id, uint16_t offset) {
-  uint8_t buf[IP_TOTAL_SIZE_MAX];
+/* takes the fragment as received, returns the payload once the datagram is complete, to be freed by the caller */
+static uint8_t *ip_reass_input(uint8_t *data, uint16_t hlen, uint16_t total, struct ip_iface *iface, size_t *len) {
   struct ip_hdr *hdr;
-  uint16_t hlen, total;
-  char addr[IP_ADDR_STR_LEN];
-
-  hdr = (struct ip_hdr *)buf;
-  hlen = IP_HDR_SIZE_MIN;
-  hdr->vhl = (IP_VERSION_IPV4 << 4 & 0xf0) | ((hlen >> 2) & 0x0f);
-  hdr->tos = 0;
-  total = hlen + len;
-  hdr->total = hton16(total);
-  hdr->id = hton16(id);
-  hdr->offset = hton16(offset);
-  hdr->ttl = 255;
-  hdr->protocol = protocol;
-  hdr->sum = 0;
-  hdr->src = src;
-  hdr->dst = dst;
-  hdr->sum = cksum16((uint16_t *)hdr, hlen, 0);
-  memcpy((uint8_t *)hdr + hlen, data, len);
+  struct ip_reass *reass;
+  struct ip_frag *frag;
+  uint16_t offset, flen;
+  uint8_t *payload;
+  int more, ret;
 
-  debugf("dev=%s, dst=%s, protocol=%u, len=%u", NET_IFACE(iface)->dev->name, ip_addr_ntop(dst, addr, sizeof(addr)),
-         protocol, total);
-  ip_dump(buf, total);
-
-  return ip_output_device(iface, buf, total, nexthop);
+  hdr = (struct ip_hdr *)data;
+  offset = ntoh16(hdr->offset);
+  more = (offset & IP_HDR_FLAG_MF) ? 1 : 0;
+  offset = (offset & IP_HDR_OFFSET_MASK) << 3;
+  flen = total - hlen;
+  if (!flen || (more && flen % 8) || offset + flen > IP_PAYLOAD_SIZE_MAX) {
+    errorf("invalid fragment, offset=%u, len=%u, more=%d", offset, flen, more);
+    net_input_release(data);
+    return NULL;
+  }
+  mutex_lock(&mutex);
+  stats.frags_in++;
+  reass = ip_reass_select(hdr, iface);
+  ret = ip_reass_fill(reass, offset, offset + flen - 1, more);
+  if (ret != 1) {
+    if (ret == -1) {
+      debugf("overlapping or invalid fragment, offset=%u, len=%u, datagram dropped", offset, flen);
+      stats.reass_drops++;
+      ip_reass_free(reass);
+    }
+    mutex_unlock(&mutex);
+    net_input_release(data);
+    return NULL;
+  }
+  if (ip_reass_reserve(reass, total) == -1 || !(frag = memory_alloc(sizeof(*frag)))) {
+    errorf("no room for the fragment, datagram dropped");
+    stats.reass_drops++;
+    ip_reass_free(reass);
+    mutex_unlock(&mutex);
+    net_input_release(data);
+    return NULL;
+  }
+  frag->buf = data;
+  frag->data = data + hlen;
+  frag->offset = offset;
+  frag->len = flen;
+  frag->next = reass->frags;
+  reass->frags = frag;
+  reass->mem += total;
+  reass_mem += total;
+  if (reass->num) {
+    mutex_unlock(&mutex);
+    return NULL;
+  }
+  /* complete, no hole left and no overlap */
+  payload = memory_alloc(reass->len);
+  if (payload) {
+    for (frag = reass->frags; frag; frag = frag->next) {
+      memcpy(payload + frag->offset, frag->data, frag->len);
+    }
+    *len = reass->len;
+    stats.reassembled++;
+  } else {
+    errorf("memory_alloc() failure");
+    stats.reass_drops++;
+  }
+  ip_reass_free(reass);
+  mutex_unlock(&mutex);
+  return payload;
 }
 
-static uint16_t ip_generate_id(void) {
-  static mutex_t mutex = MUTEX_INITIALIZER;
-  static uint16_t id = 128;
-  uint16_t ret;
+static void ip_reass_timeout(void *arg) {
+  struct ip_reass *reass;
 
+  reass = (struct ip_reass *)arg;
   mutex_lock(&mutex);
-  ret = id++;
+  /* NOTE: the datagram may have been completed or dropped while waiting for the mutex */
+  if (reass->used && !net_timeout_pending(&reass->timeout)) {
+    debugf("timeout, id=%u, holes=%d", ntoh16(reass->id), reass->num);
+    stats.reass_timeouts++;
+    ip_reass_free(reass);
+  }
   mutex_unlock(&mutex);
-  return ret;
 }
 
-ssize_t ip_output(uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst) {
-  struct ip_iface *iface;
-  char addr[IP_ADDR_STR_LEN];
-  uint16_t id;
-
-  if (src == IP_ADDR_ANY && dst == IP_ADDR_BROADCAST) {
-    errorf("source address is required for broadcast addresses");
-    return -1;
-  }
+/*
+ * Path MTU Discovery
+ *
+ * NOTE: an entry only lowers the MTU of the device toward the destination, it is forgotten after IP_PMTU_TIMEOUT so
+ * that a larger path MTU is tried again. The destination caches are invalidated whenever an entry changes.
+ */
 
-  struct ip_route *route = ip_route_lookup(dst);
-  if (!route) {
-    errorf("no route to host, addr=%s", ip_addr_ntop(dst, addr, sizeof(addr)));
-    return -1;
-  }
-  iface = route->iface;
-  if (src != IP_ADDR_ANY && src != iface->unicast) {
-    errorf("unable to output with specified source address, addr=%s", ip_addr_ntop(src, addr, sizeof(addr)));
-    return -1;
-  }
-  ip_addr_t nexthop = (route->nexthop != IP_ADDR_ANY) ? route->nexthop : dst;
+/* NOTE: must be called after mutex locked */
+static uint16_t ip_pmtu_lookup(ip_addr_t dst, uint16_t mtu) {
+  struct ip_pmtu *entry;
 
-  if (NET_IFACE(iface)->dev->mtu < IP_HDR_SIZE_MIN + len) {
-    errorf("too long, dev=%s, mtu=%u < %zu", NET_IFACE(iface)->dev->name, NET_IFACE(iface)->dev->mtu,
-           IP_HDR_SIZE_MIN + len);
-    return -1;
+  for (entry = pmtus; entry < tailof(pmtus); entry++) {
+    if (entry->used && entry->addr == dst) {
+      return MIN(mtu, entry->mtu);
+    }
   }
+  return mtu;
+}
 
-  id = ip_generate_id();
+/* estimates the MTU from the length of the returned datagram, for routers not telling theirs, see rfc1191 section 7 */
+static uint16_t ip_pmtu_plateau(uint16_t total) {
+  static const uint16_t plateaus[] = {32000, 17914, 8166, 4352, 2002, 1492, 1006, IP_PMTU_MIN};
+  const uint16_t *p;
 
-  if (ip_output_core(iface, protocol, data, len, iface->unicast, dst, nexthop, id, 0) == -1) {
+  for (p = plateaus; p < tailof(plateaus); p++) {
+    if (*p < total) {
+      return *p;
+    }
+  }
+  return IP_PMTU_MIN;
+}
+
+void ip_route_update_mtu(ip_addr_t dst, uint16_t mtu) {
+  struct ip_pmtu *entry, *free = NULL, *oldest = NULL;
+  char addr[IP_ADDR_STR_LEN];
+
+  mtu = MAX(mtu, IP_PMTU_MIN);
+  mutex_lock(&mutex);
+  for (entry = pmtus; entry < tailof(pmtus); entry++) {
+    if (!entry->used) {
+      free = free ? free : entry;
+      continue;
+    }
+    if (entry->addr == dst) {
+      break;
+    }
+    if (!oldest || timercmp(&entry->timestamp, &oldest->timestamp, <)) {
+      oldest = entry;
+    }
+  }
+  if (entry == tailof(pmtus)) {
+    entry = free ? free : oldest;
+    entry->used = 1;
+    entry->addr = dst;
+  } else if (mtu >= entry->mtu) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  entry->mtu = mtu;
+  gettimeofday(&entry->timestamp, NULL);
+  stats.pmtu_updates++;
+  mutex_unlock(&mutex);
+  infof("addr=%s, mtu=%u", ip_addr_ntop(dst, addr, sizeof(addr)), mtu);
+  ip_dst_cache_invalidate();
+}
+
+static void ip_pmtu_timer_handler(void) {
+  struct ip_pmtu *entry;
+  struct timeval now, diff;
+  int expired = 0;
+
+  mutex_lock(&mutex);
+  gettimeofday(&now, NULL);
+  for (entry = pmtus; entry < tailof(pmtus); entry++) {
+    if (!entry->used) {
+      continue;
+    }
+    timersub(&now, &entry->timestamp, &diff);
+    if (diff.tv_sec > IP_PMTU_TIMEOUT) {
+      memset(entry, 0, sizeof(*entry));
+      expired = 1;
+    }
+  }
+  mutex_unlock(&mutex);
+  if (expired) {
+    ip_dst_cache_invalidate();
+  }
+}
+
+uint16_t ip_route_get_mtu(ip_addr_t dst) {
+  struct ip_route *route;
+  uint16_t mtu;
+
+  route = ip_route_lookup(dst);
+  if (!route) {
+    return 0;
+  }
+  mutex_lock(&mutex);
+  mtu = ip_pmtu_lookup(dst, NET_IFACE(route->iface)->dev->mtu);
+  mutex_unlock(&mutex);
+  return mtu;
+}
+
+/* NOTE: data is the datagram returned by an ICMP error message, its header and at least 8 bytes of the payload */
+void ip_error_input(uint8_t type, uint8_t code, uint32_t info, const uint8_t *data, size_t len) {
+  struct ip_hdr *hdr;
+  uint16_t hlen, mtu;
+  struct ip_protocol *protocol;
+
+  hdr = (struct ip_hdr *)data;
+  if (len < IP_HDR_SIZE_MIN || (hdr->vhl >> 4) != IP_VERSION_IPV4) {
+    return;
+  }
+  hlen = (hdr->vhl & 0x0f) << 2;
+  if (len < hlen + 8u || !ip_iface_select(hdr->src)) {
+    return; /* NOTE: not a datagram of ours */
+  }
+  if (type == ICMP_TYPE_DEST_UNREACH && code == ICMP_CODE_FRAG_NEEDED) {
+    mtu = info & 0xffff; /* next-hop MTU, see rfc1191 section 4 */
+    if (!mtu || mtu >= ntoh16(hdr->total)) {
+      mtu = ip_pmtu_plateau(ntoh16(hdr->total));
+    }
+    info = mtu; /* NOTE: applied by the protocol once checked, a forged error must not lower the path MTU */
+  }
+  protocol = &protocols[hdr->protocol];
+  if (protocol->err) {
+    protocol->err(data + hlen, len - hlen, hdr->src, hdr->dst, type, code, info);
+  }
+}
+
+void ip_input(const uint8_t *data, size_t len, struct net_device *dev) {
+  struct ip_hdr *hdr;
+  uint8_t v;
+  uint16_t hlen, total, offset;
+
+  if (len < IP_HDR_SIZE_MIN) {
+    errorf("too short");
+    return;
+  }
+  hdr = (struct ip_hdr *)data;
+
+  v = hdr->vhl >> 4;
+  if (v != IP_VERSION_IPV4) {
+    errorf("ip version error: v=%u", v);
+    return;
+  }
+
+  hlen = (hdr->vhl & 0x0f) << 2;
+  if (len < hlen) {
+    errorf("header length error: len=%zu < hlen=%u", len, hlen);
+    return;
+  }
+
+  total = ntoh16(hdr->total);
+  if (len < total) {
+    errorf("total length error: len=%zu < total=%u", len, total);
+    return;
+  }
+
+  if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
+    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
+           ntoh16(cksum16((uint16_t *)hdr, hlen, -hdr->sum)));
+    return;
+  }
+
+  struct ip_iface *iface;
+  iface = (struct ip_iface *)net_device_get_iface(dev, NET_IFACE_FAMILY_IP);
+  if (!iface) {
+    /* no iface on the device */
+    return;
+  }
+
+  if (hdr->dst != iface->unicast && hdr->dst != IP_ADDR_BROADCAST && hdr->dst != iface->broadcast) {
+    /* for other device */
+    return;
+  }
+
+  char addr[IP_ADDR_STR_LEN];
+  debugf("dev=%s, iface=%s, protocol=%u, total=%u", dev->name, ip_addr_ntop(iface->unicast, addr, sizeof(addr)),
+         hdr->protocol, total);
+  ip_dump(data, total);
+
+  offset = ntoh16(hdr->offset);
+  if (offset & (IP_HDR_FLAG_MF | IP_HDR_OFFSET_MASK)) {
+    errorf("invalid fragment, hlen=%u", hlen); /* NOTE: the valid ones are taken by ip_early_input() */
+    return;
+  }
+  ip_input_deliver(hdr->protocol, (uint8_t *)hdr + hlen, total - hlen, hdr->src, hdr->dst, iface);
+}
+
+static int ip_resolve(struct ip_iface *iface, ip_addr_t dst, uint8_t *hwaddr) {
+  if (NET_IFACE(iface)->dev->flags & NET_DEVICE_FLAG_NEED_ARP) {
+    if (dst == iface->broadcast || dst == IP_ADDR_BROADCAST) {
+      memcpy(hwaddr, NET_IFACE(iface)->dev->broadcast, NET_IFACE(iface)->dev->alen);
+    } else {
+      return arp_resolve(NET_IFACE(iface), dst, hwaddr);
+    }
+  }
+  return ARP_RESOLVE_FOUND;
+}
+
+/* NOTE: hwaddr is NULL while the link address of nexthop is resolved, the datagram is then held by ARP */
+static int ip_output_device(struct ip_iface *iface, ip_addr_t nexthop, const uint8_t *hwaddr, const uint8_t *data,
+                            size_t len) {
+  if (!hwaddr) {
+    return arp_hold(NET_IFACE(iface), nexthop, data, len);
+  }
+  return net_device_output(NET_IFACE(iface)->dev, NET_PROTOCOL_TYPE_IP, data, len, hwaddr);
+}
+
+static uint16_t ip_generate_id(uint16_t num) {
+  static mutex_t mutex = MUTEX_INITIALIZER;
+  static uint16_t id = 128;
+  uint16_t ret;
+
+  mutex_lock(&mutex);
+  ret = id;
+  id += num;
+  mutex_unlock(&mutex);
+  return ret;
+}
+
+/*
+ * IP Header Template
+ */
+
+void ip_hdr_template_init(struct ip_hdr_template *tmpl, uint8_t protocol, ip_addr_t src, ip_addr_t dst) {
+  struct ip_hdr *hdr;
+  struct {
+    ip_addr_t src;
+    ip_addr_t dst;
+    uint8_t zero;
+    uint8_t protocol;
+  } pseudo;
+
+  hdr = (struct ip_hdr *)tmpl->hdr;
+  hdr->vhl = (IP_VERSION_IPV4 << 4 & 0xf0) | ((IP_HDR_SIZE_MIN >> 2) & 0x0f);
+  hdr->tos = 0;
+  hdr->total = 0;
+  hdr->id = 0;
+  hdr->offset = 0;
+  hdr->ttl = 255;
+  hdr->protocol = protocol;
+  hdr->sum = 0;
+  hdr->src = src;
+  hdr->dst = dst;
+  tmpl->sum = ~cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+  pseudo.src = src;
+  pseudo.dst = dst;
+  pseudo.zero = 0;
+  pseudo.protocol = protocol;
+  tmpl->psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), 0);
+}
+
+void ip_hdr_template_set_df(struct ip_hdr_template *tmpl) {
+  struct ip_hdr *hdr;
+
+  hdr = (struct ip_hdr *)tmpl->hdr;
+  hdr->offset = hton16(IP_HDR_FLAG_DF);
+  tmpl->sum = ~cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+}
+
+uint32_t ip_hdr_template_psum(const struct ip_hdr_template *tmpl, size_t len) {
+  return tmpl->psum + hton16(len);
+}
+
+/* NOTE: the checksum is adjusted incrementally, only the total length and the id differ from the template */
+static void ip_hdr_template_apply(const struct ip_hdr_template *tmpl, struct ip_hdr *hdr, uint16_t total, uint16_t id) {
+  memcpy(hdr, tmpl->hdr, IP_HDR_SIZE_MIN);
+  hdr->total = hton16(total);
+  hdr->id = hton16(id);
+  hdr->sum = cksum16(&hdr->total, sizeof(hdr->total) + sizeof(hdr->id), tmpl->sum);
+}
+
+static ssize_t ip_output_core(struct ip_iface *iface, ip_addr_t nexthop, const uint8_t *hwaddr,
+                              const struct ip_hdr_template *tmpl, const uint8_t *data, size_t len) {
+  uint8_t buf[IP_TOTAL_SIZE_MAX];
+  struct ip_hdr *hdr;
+  uint16_t total;
+  char addr[IP_ADDR_STR_LEN];
+
+  hdr = (struct ip_hdr *)buf;
+  total = IP_HDR_SIZE_MIN + len;
+  ip_hdr_template_apply(tmpl, hdr, total, ip_generate_id(1));
+  memcpy(hdr + 1, data, len);
+
+  debugf("dev=%s, dst=%s, protocol=%u, len=%u", NET_IFACE(iface)->dev->name,
+         ip_addr_ntop(hdr->dst, addr, sizeof(addr)), hdr->protocol, total);
+  ip_dump(buf, total);
+
+  return ip_output_device(iface, nexthop, hwaddr, buf, total);
+}
+
+/*
+ * NOTE: the fragments share the id, each of them has the header of orig (without options) with its own offset. The
+ * fragments of a forwarded fragment keep their place in the original datagram.
+ */
+static ssize_t ip_output_fragmented(struct ip_iface *iface, ip_addr_t nexthop, const uint8_t *hwaddr, uint16_t mtu,
+                                    const struct ip_hdr *orig, uint16_t id, const uint8_t *data, size_t len) {
+  uint8_t buf[IP_TOTAL_SIZE_MAX];
+  struct ip_hdr *hdr;
+  uint16_t total, flags, base, more;
+  size_t size, offset, n;
+  unsigned int num = 0;
+
+  size = (mtu - IP_HDR_SIZE_MIN) & ~7; /* the offset is in units of 8 bytes */
+  base = (ntoh16(orig->offset) & IP_HDR_OFFSET_MASK) << 3;
+  more = ntoh16(orig->offset) & IP_HDR_FLAG_MF;
+  hdr = (struct ip_hdr *)buf;
+  for (offset = 0; offset < len; offset += n) {
+    n = MIN(size, len - offset);
+    total = IP_HDR_SIZE_MIN + n;
+    memcpy(hdr, orig, IP_HDR_SIZE_MIN);
+    hdr->vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr->total = hton16(total);
+    hdr->id = hton16(id);
+    flags = offset + n < len ? IP_HDR_FLAG_MF : more;
+    hdr->offset = hton16(flags | (base + offset) >> 3);
+    hdr->sum = 0;
+    hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+    memcpy(hdr + 1, data + offset, n);
+    debugf("dev=%s, protocol=%u, len=%u, offset=%zu", NET_IFACE(iface)->dev->name, hdr->protocol, total, offset);
+    if (ip_output_device(iface, nexthop, hwaddr, buf, total) == -1) {
+      return -1;
+    }
+    num++;
+  }
+  mutex_lock(&mutex);
+  stats.fragmented++;
+  stats.frags_out += num;
+  mutex_unlock(&mutex);
+  return len;
+}
+
+/*
+ * Generic segmentation offload (in software)
+ *
+ * NOTE: the route, the link address and the IP header are resolved once for the whole segment, only the headers are
+ * replicated and patched for each frame just before it is passed to the device. th is the transport header (gso->hlen
+ * bytes) and data its payload, which is copied once, straight into the frames. Without payload, a single frame is sent.
+ */
+static ssize_t ip_output_segmented(struct ip_iface *iface, ip_addr_t nexthop, const uint8_t *hwaddr, uint16_t mtu,
+                                   const struct ip_hdr_template *tmpl, const uint8_t *th, const uint8_t *data,
+                                   size_t len, const struct ip_gso *gso) {
+  uint8_t buf[IP_TOTAL_SIZE_MAX];
+  struct ip_hdr *hdr;
+  uint16_t total, id;
+  size_t offset, n;
+  uint32_t sum;
+
+  if (mtu < IP_HDR_SIZE_MIN + gso->hlen + gso->size) {
+    errorf("too long, dev=%s, mtu=%u < %u", NET_IFACE(iface)->dev->name, mtu, IP_HDR_SIZE_MIN + gso->hlen + gso->size);
+    mutex_lock(&mutex);
+    stats.frag_needed++;
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  id = ip_generate_id(len > gso->size ? (len + gso->size - 1) / gso->size : 1);
+  hdr = (struct ip_hdr *)buf;
+  offset = 0;
+  do {
+    n = MIN(gso->size, len - offset);
+    total = IP_HDR_SIZE_MIN + gso->hlen + n;
+    ip_hdr_template_apply(tmpl, hdr, total, id++);
+    memcpy(hdr + 1, th, gso->hlen); /* NOTE: patched by the fixup of the previous frame */
+    sum = cksum16_copy((uint8_t *)(hdr + 1) + gso->hlen, data + offset, n, ip_hdr_template_psum(tmpl, gso->hlen + n));
+    gso->fixup((uint8_t *)(hdr + 1), gso->hlen + n, offset, offset + n == len, sum);
+    debugf("dev=%s, protocol=%u, len=%u, offset=%zu", NET_IFACE(iface)->dev->name, hdr->protocol, total, offset);
+    if (ip_output_device(iface, nexthop, hwaddr, buf, total) == -1) {
+      return -1;
+    }
+    offset += n;
+  } while (offset < len);
+  return gso->hlen + len;
+}
+
+/* NOTE: hwaddr is the link address of nexthop (NULL if not resolved yet), mtu is the path MTU */
+static ssize_t ip_output_link(struct ip_iface *iface, ip_addr_t nexthop, const uint8_t *hwaddr, uint16_t mtu,
+                              const struct ip_hdr_template *tmpl, const uint8_t *data, size_t len,
+                              const struct ip_gso *gso) {
+  if (gso && mtu < IP_HDR_SIZE_MIN + len) {
+    if (ip_output_segmented(iface, nexthop, hwaddr, mtu, tmpl, data, data + gso->hlen, len - gso->hlen, gso) == -1) {
+      errorf("ip_output_segmented() failure");
+      return -1;
+    }
+    return len;
+  }
+
+  if (mtu < IP_HDR_SIZE_MIN + len) {
+    if (ntoh16(((struct ip_hdr *)tmpl->hdr)->offset) & IP_HDR_FLAG_DF) {
+      /* NOTE: what a router would answer with Fragmentation Needed, the sender picks up the path MTU from its dst */
+      errorf("too long, dev=%s, mtu=%u < %zu", NET_IFACE(iface)->dev->name, mtu, IP_HDR_SIZE_MIN + len);
+      mutex_lock(&mutex);
+      stats.frag_needed++;
+      mutex_unlock(&mutex);
+      return -1;
+    }
+    if (ip_output_fragmented(iface, nexthop, hwaddr, mtu, (struct ip_hdr *)tmpl->hdr, ip_generate_id(1), data, len) ==
+        -1) {
+      errorf("ip_output_fragmented() failure");
+      return -1;
+    }
+    return len;
+  }
+
+  if (ip_output_core(iface, nexthop, hwaddr, tmpl, data, len) == -1) {
     errorf("ip_output_core() failure");
     return -1;
   }
   return len;
 }
 
+ssize_t ip_output(uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst) {
+  return ip_output_gso(protocol, data, len, src, dst, NULL);
+}
+
+/* NOTE: gso may be NULL, it is used only if the segment does not fit in the MTU */
+ssize_t ip_output_gso(uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
+                      const struct ip_gso *gso) {
+  struct ip_hdr_template tmpl;
+  struct ip_iface *iface;
+  char addr[IP_ADDR_STR_LEN];
+
+  if (src == IP_ADDR_ANY && dst == IP_ADDR_BROADCAST) {
+    errorf("source address is required for broadcast addresses");
+    return -1;
+  }
+  if (src == IP_ADDR_ANY) {
+    iface = ip_route_get_iface(dst);
+    if (!iface) {
+      errorf("no route to host, addr=%s", ip_addr_ntop(dst, addr, sizeof(addr)));
+      return -1;
+    }
+    src = iface->unicast;
+  }
+  ip_hdr_template_init(&tmpl, protocol, src, dst);
+  return ip_output_template(&tmpl, data, len, gso);
+}
+
+/* NOTE: same as ip_output_gso() but the header is taken from the template, whose source address must be concrete */
+ssize_t ip_output_template(const struct ip_hdr_template *tmpl, const uint8_t *data, size_t len,
+                           const struct ip_gso *gso) {
+  struct ip_dst_cache dst = {};
+
+  return ip_output_dst(&dst, tmpl, data, len, gso);
+}
+
+/*
+ * Destination Cache
+ *
+ * NOTE: a connection keeps the route and the link address resolved for its destination, they are looked up again
+ * only after a route or a neighbor has changed since then.
+ */
+
+void ip_dst_cache_invalidate(void) { atomic_inc(&dst_generation); }
+
+static int ip_dst_cache_resolve(struct ip_dst_cache *dst, const struct ip_hdr *hdr) {
+  struct ip_route *route;
+  unsigned int gen;
+  char addr[IP_ADDR_STR_LEN];
+  int ret;
+
+  gen = atomic_read(&dst_generation); /* NOTE: read before the lookups, a change during them invalidates the result */
+  dst->stale = 0;
+  route = ip_route_lookup(hdr->dst);
+  if (!route) {
+    errorf("no route to host, addr=%s", ip_addr_ntop(hdr->dst, addr, sizeof(addr)));
+    return ARP_RESOLVE_ERROR;
+  }
+  if (hdr->src != route->iface->unicast) {
+    errorf("unable to output with specified source address, addr=%s", ip_addr_ntop(hdr->src, addr, sizeof(addr)));
+    return ARP_RESOLVE_ERROR;
+  }
+  dst->iface = route->iface;
+  mutex_lock(&mutex);
+  dst->mtu = ip_pmtu_lookup(hdr->dst, NET_IFACE(route->iface)->dev->mtu);
+  mutex_unlock(&mutex);
+  dst->nexthop = (route->nexthop != IP_ADDR_ANY) ? route->nexthop : hdr->dst;
+  if (NET_IFACE(dst->iface)->dev->flags & NET_DEVICE_FLAG_NEED_ARP) {
+    dst->stale = arp_stale_generation(); /* NOTE: read before the lookup, which marks the entry as used */
+  }
+  ret = ip_resolve(dst->iface, dst->nexthop, dst->hwaddr);
+  if (ret == ARP_RESOLVE_FOUND) {
+    dst->gen = gen;
+  }
+  return ret;
+}
+
+/*
+ * NOTE: dst must belong to the flow of the template, it is resolved again only if it has been invalidated. hwaddr is
+ * set to NULL while the link address is resolved, the datagram is then held by ARP and dst is resolved again for the
+ * next one.
+ */
+static int ip_dst_cache_get(struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl, const uint8_t **hwaddr) {
+  int ret;
+
+  *hwaddr = dst->hwaddr;
+  if (dst->gen != atomic_read(&dst_generation)) {
+    dst->gen = 0;
+    ret = ip_dst_cache_resolve(dst, (struct ip_hdr *)tmpl->hdr);
+    if (ret == ARP_RESOLVE_ERROR) {
+      return -1;
+    }
+    if (ret == ARP_RESOLVE_INCOMPLETE) {
+      *hwaddr = NULL;
+    }
+  } else if (dst->stale && dst->stale != arp_stale_generation()) {
+    /* NOTE: the next hop may have gone stale, it is kept if in use */
+    dst->stale = arp_stale_generation();
+    arp_touch(dst->nexthop);
+  }
+  return 0;
+}
+
+ssize_t ip_output_dst(struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl, const uint8_t *data, size_t len,
+                      const struct ip_gso *gso) {
+  const uint8_t *hwaddr;
+
+  if (ip_dst_cache_get(dst, tmpl, &hwaddr) == -1) {
+    return -1;
+  }
+  return ip_output_link(dst->iface, dst->nexthop, hwaddr, dst->mtu, tmpl, data, len, gso);
+}
+
+ssize_t ip_output_dst_sg(struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl, const uint8_t *hdr,
+                         const uint8_t *data, size_t len, const struct ip_gso *gso) {
+  const uint8_t *hwaddr;
+
+  if (ip_dst_cache_get(dst, tmpl, &hwaddr) == -1) {
+    return -1;
+  }
+  return ip_output_segmented(dst->iface, dst->nexthop, hwaddr, dst->mtu, tmpl, hdr, data, len, gso);
+}
+
+/*
+ * Forwarding
+ *
+ * NOTE: a datagram for another host is taken by the softirq before the GRO stage, its header is updated in place in
+ * the buffer it has been received in, and the link header is written in front of it for the egress device (see
+ * net_device_output_inplace()), so that the frame is sent without a copy. The datagrams are held per egress
+ * device until the end of the batch of the softirq, the link address of the next hop is looked up only once while
+ * they go to the same one.
+ */
+
+void ip_set_forwarding(int enable) { forwarding = enable; }
+
+static int ip_addr_is_local(ip_addr_t addr) {
+  struct ip_iface *iface;
+
+  if (addr == IP_ADDR_ANY || addr == IP_ADDR_BROADCAST || IP_ADDR_IS_MULTICAST(addr)) {
+    return 1;
+  }
+  for (iface = ifaces; iface; iface = iface->next) {
+    if (addr == iface->unicast || addr == iface->broadcast) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* NOTE: no error about an ICMP error, a non-initial fragment or a datagram from no single host, see rfc1812 4.3.2.7 */
+static void ip_forward_icmp_error(const struct ip_hdr *hdr, uint16_t hlen, uint16_t total, uint8_t type, uint8_t code,
+                                  uint32_t values, struct ip_iface *iface) {
+  if ((ntoh16(hdr->offset) & IP_HDR_OFFSET_MASK) || ip_addr_is_local(hdr->src)) {
+    return;
+  }
+  if (hdr->protocol == IP_PROTOCOL_ICMP && total > hlen) {
+    switch (((uint8_t *)hdr)[hlen]) {
+      case ICMP_TYPE_ECHOREPLY:
+      case ICMP_TYPE_ECHO:
+      case ICMP_TYPE_TIMESTAMP:
+      case ICMP_TYPE_TIMESTAMPREPLY:
+      case ICMP_TYPE_INFO_REQUEST:
+      case ICMP_TYPE_INFO_REPLY:
+        break;
+      default:
+        return;
+    }
+  }
+  icmp_output(type, code, values, (uint8_t *)hdr, MIN(total, hlen + 8), iface->unicast, hdr->src);
+}
+
+static void ip_forward_flush(struct ip_fwd_batch *batch) {
+  struct net_device *dev;
+  int i, ret;
+
+  dev = NET_IFACE(batch->iface)->dev;
+  for (i = 0; i < batch->num; i++) {
+    ret = net_device_output_inplace(dev, NET_PROTOCOL_TYPE_IP, batch->pkts[i].data, batch->pkts[i].len,
+                                    batch->pkts[i].hwaddr);
+    if (!batch->pkts[i].local) {
+      if (ret == -1) {
+        fwd_stats.fwd_drops++;
+      } else {
+        fwd_stats.forwarded++;
+      }
+    }
+    net_input_release(batch->pkts[i].data);
+  }
+  if (batch->num) {
+    fwd_stats.fwd_batches++;
+  }
+  batch->num = 0;
+}
+
+static void ip_forward_queue(struct ip_fwd_batch *batch, uint8_t *data, size_t len, const uint8_t *hwaddr, int local) {
+  batch->pkts[batch->num].data = data;
+  batch->pkts[batch->num].len = len;
+  memcpy(batch->pkts[batch->num].hwaddr, hwaddr, NET_DEVICE_ADDR_LEN);
+  batch->pkts[batch->num].local = local;
+  if (++batch->num == IP_FWD_BATCH_SIZE) {
+    ip_forward_flush(batch);
+  }
+}
+
+static struct ip_fwd_batch *ip_forward_batch(struct ip_iface *iface) {
+  struct ip_fwd_batch *batch;
+
+  for (batch = fwd_batches; batch < tailof(fwd_batches); batch++) {
+    if (batch->iface == iface) {
+      return batch;
+    }
+    if (!batch->iface) {
+      batch->iface = iface;
+      return batch;
+    }
+  }
+  return NULL;
+}
+
+/* returns 0 if found, -1 to drop the datagram (an error has been sent if unreachable) */
+static int ip_forward_resolve(struct ip_fwd_batch *batch, struct ip_iface *iface, ip_addr_t nexthop, uint8_t *hwaddr) {
+  unsigned int gen, stale;
+  int ret;
+
+  gen = atomic_read(&dst_generation);
+  stale = arp_stale_generation();
+  if (batch && batch->gen == gen && batch->stale == stale && batch->nexthop == nexthop) {
+    memcpy(hwaddr, batch->hwaddr, NET_DEVICE_ADDR_LEN);
+    return 0;
+  }
+  ret = ip_resolve(iface, nexthop, hwaddr);
+  if (ret != ARP_RESOLVE_FOUND) {
+    return ret == ARP_RESOLVE_ERROR ? -1 : 1;
+  }
+  if (batch) {
+    batch->gen = gen;
+    batch->stale = stale;
+    batch->nexthop = nexthop;
+    memcpy(batch->hwaddr, hwaddr, NET_DEVICE_ADDR_LEN);
+  }
+  return 0;
+}
+
+static void ip_forward(uint8_t *data, uint16_t hlen, uint16_t total, struct ip_iface *iface) {
+  struct ip_hdr *hdr;
+  struct ip_route *route;
+  struct ip_iface *egress;
+  struct ip_fwd_batch *batch;
+  ip_addr_t nexthop;
+  uint8_t buf[NET_DEVICE_ADDR_LEN], *hwaddr = buf;
+  uint16_t mtu;
+  uint32_t sum;
+
+  hdr = (struct ip_hdr *)data;
+  if (hdr->ttl <= 1) {
+    ip_forward_icmp_error(hdr, hlen, total, ICMP_TYPE_TIME_EXCEEDED, ICMP_CODE_EXCEEDED_TTL, 0, iface);
+    fwd_stats.fwd_time_exceeded++;
+    net_input_release(data);
+    return;
+  }
+  route = ip_route_lookup(hdr->dst);
+  if (!route) {
+    ip_forward_icmp_error(hdr, hlen, total, ICMP_TYPE_DEST_UNREACH, ICMP_CODE_NET_UNREACH, 0, iface);
+    fwd_stats.fwd_unreachable++;
+    net_input_release(data);
+    return;
+  }
+  egress = route->iface;
+  nexthop = (route->nexthop != IP_ADDR_ANY) ? route->nexthop : hdr->dst;
+  mtu = NET_IFACE(egress)->dev->mtu;
+  if (total > mtu && (ntoh16(hdr->offset) & IP_HDR_FLAG_DF || hlen != IP_HDR_SIZE_MIN)) {
+    if (ntoh16(hdr->offset) & IP_HDR_FLAG_DF) {
+      ip_forward_icmp_error(hdr, hlen, total, ICMP_TYPE_DEST_UNREACH, ICMP_CODE_FRAG_NEEDED, hton32(mtu), iface);
+      fwd_stats.fwd_frag_needed++;
+    } else {
+      fwd_stats.fwd_drops++; /* NOTE: the options are not copied into the fragments */
+    }
+    net_input_release(data);
+    return;
+  }
+  batch = ip_forward_batch(egress);
+  switch (ip_forward_resolve(batch, egress, nexthop, hwaddr)) {
+    case 0:
+      break;
+    case -1:
+      ip_forward_icmp_error(hdr, hlen, total, ICMP_TYPE_DEST_UNREACH, ICMP_CODE_HOST_UNREACH, 0, iface);
+      fwd_stats.fwd_unreachable++;
+      net_input_release(data);
+      return;
+    default:
+      hwaddr = NULL; /* NOTE: held by ARP while the link address is resolved */
+      break;
+  }
+  /* decrements TTL, the checksum is adjusted incrementally, see https://tools.ietf.org/html/rfc1624 */
+  sum = hdr->sum + hton16(0x0100);
+  hdr->sum = sum + (sum >= 0xffff);
+  hdr->ttl--;
+  if (total > mtu) {
+    if (batch) {
+      ip_forward_flush(batch); /* NOTE: keeps the order of the datagrams */
+    }
+    if (ip_output_fragmented(egress, nexthop, hwaddr, mtu, hdr, ntoh16(hdr->id), data + hlen, total - hlen) == -1) {
+      fwd_stats.fwd_drops++;
+    } else {
+      fwd_stats.forwarded++;
+    }
+    net_input_release(data);
+    return;
+  }
+  if (!batch || !hwaddr) {
+    if (ip_output_device(egress, nexthop, hwaddr, data, total) == -1) {
+      fwd_stats.fwd_drops++;
+    } else {
+      fwd_stats.forwarded++;
+    }
+    net_input_release(data);
+    return;
+  }
+  ip_forward_queue(batch, data, total, hwaddr, 0);
+}
+
+/*
+ * Reflection
+ *
+ * NOTE: a request that the protocol answers with the same message, e.g. an ICMP Echo, is turned into its reply in the
+ * buffer it has been received in and sent back the same way as a forwarded datagram, without going through
+ * ip_output(). The protocol rewrites its own message (see ip_protocol_register_reflect()), the header is rewritten
+ * here. The others, with options, fragmented, or from one of our addresses, are left to ip_input().
+ */
+
+/* returns 1 if the datagram has been taken */
+static int ip_reflect(uint8_t *data, uint16_t hlen, uint16_t total, struct ip_iface *iface) {
+  struct ip_hdr *hdr;
+  struct ip_protocol *protocol;
+  struct ip_route *route;
+  struct ip_iface *egress;
+  struct ip_fwd_batch *batch;
+  ip_addr_t nexthop, addr;
+  uint8_t buf[NET_DEVICE_ADDR_LEN], *hwaddr = buf;
+
+  hdr = (struct ip_hdr *)data;
+  protocol = &protocols[hdr->protocol];
+  if (!protocol->reflect || hlen != IP_HDR_SIZE_MIN || (ntoh16(hdr->offset) & (IP_HDR_FLAG_MF | IP_HDR_OFFSET_MASK)) ||
+      ip_addr_is_local(hdr->src)) {
+    return 0;
+  }
+  if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
+    return 0; /* NOTE: reported by ip_input() */
+  }
+  route = ip_route_lookup(hdr->src);
+  if (!route || total > NET_IFACE(route->iface)->dev->mtu) {
+    return 0;
+  }
+  egress = route->iface;
+  nexthop = (route->nexthop != IP_ADDR_ANY) ? route->nexthop : hdr->src;
+  batch = ip_forward_batch(egress);
+  switch (ip_forward_resolve(batch, egress, nexthop, hwaddr)) {
+    case 0:
+      break;
+    case -1:
+      return 0;
+    default:
+      hwaddr = NULL; /* NOTE: held by ARP while the link address is resolved */
+      break;
+  }
+  switch (protocol->reflect(data + hlen, total - hlen, hdr->src, hdr->dst, iface)) {
+    case 0:
+      return 0;
+    case -1:
+      net_input_release(data);
+      return 1;
+  }
+  addr = hdr->src;
+  hdr->src = hdr->dst;
+  hdr->dst = addr;
+  hdr->ttl = 255;
+  hdr->sum = 0;
+  hdr->sum = cksum16((uint16_t *)hdr, hlen, 0);
+  if (!batch || !hwaddr) {
+    ip_output_device(egress, nexthop, hwaddr, data, total);
+    net_input_release(data);
+    return 1;
+  }
+  ip_forward_queue(batch, data, total, hwaddr, 1);
+  return 1;
+}
+
+/* returns 1 if the fragment has been taken, see ip_reass_input() */
+static int ip_early_reass(uint8_t *data, uint16_t hlen, uint16_t total, struct ip_iface *iface) {
+  struct ip_hdr *hdr;
+  uint8_t protocol, *payload;
+  ip_addr_t src, dst;
+  size_t plen;
+
+  hdr = (struct ip_hdr *)data;
+  if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
+    return 0; /* NOTE: reported by ip_input() */
+  }
+  debugf("fragment, protocol=%u, total=%u", hdr->protocol, total);
+  ip_dump(data, total);
+  protocol = hdr->protocol;
+  src = hdr->src;
+  dst = hdr->dst;
+  payload = ip_reass_input(data, hlen, total, iface, &plen); /* NOTE: data is no longer ours */
+  if (payload) {
+    ip_input_deliver(protocol, payload, plen, src, dst, iface);
+    memory_free(payload);
+  }
+  return 1;
+}
+
+/* returns 1 if the datagram is for another host, reflected back to its source, or a fragment, and has been taken */
+static int ip_early_input(uint8_t *data, size_t len, struct net_device *dev) {
+  struct ip_hdr *hdr;
+  struct ip_iface *iface;
+  uint16_t hlen, total;
+
+  if (len < IP_HDR_SIZE_MIN) {
+    return 0;
+  }
+  hdr = (struct ip_hdr *)data;
+  hlen = (hdr->vhl & 0x0f) << 2;
+  total = ntoh16(hdr->total);
+  if ((hdr->vhl >> 4) != IP_VERSION_IPV4 || hlen < IP_HDR_SIZE_MIN || total < hlen || len < total) {
+    return 0;
+  }
+  iface = (struct ip_iface *)net_device_get_iface(dev, NET_IFACE_FAMILY_IP);
+  if (!iface) {
+    return 0;
+  }
+  if ((ntoh16(hdr->offset) & (IP_HDR_FLAG_MF | IP_HDR_OFFSET_MASK)) &&
+      (hdr->dst == iface->unicast || hdr->dst == IP_ADDR_BROADCAST || hdr->dst == iface->broadcast)) {
+    return ip_early_reass(data, hlen, total, iface);
+  }
+  if (hdr->dst == iface->unicast) {
+    return ip_reflect(data, hlen, total, iface);
+  }
+  if (!forwarding || ip_addr_is_local(hdr->dst) || ip_addr_is_local(hdr->src)) {
+    return 0;
+  }
+  if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
+    return 0; /* NOTE: reported by ip_input() */
+  }
+  ip_forward(data, hlen, total, iface);
+  return 1;
+}
+
+static void ip_early_complete(void) {
+  struct ip_fwd_batch *batch;
+
+  for (batch = fwd_batches; batch < tailof(fwd_batches) && batch->iface; batch++) {
+    ip_forward_flush(batch);
+  }
+  if (!forwarding) {
+    return;
+  }
+  mutex_lock(&mutex);
+  stats.forwarded += fwd_stats.forwarded;
+  stats.fwd_batches += fwd_stats.fwd_batches;
+  stats.fwd_time_exceeded += fwd_stats.fwd_time_exceeded;
+  stats.fwd_unreachable += fwd_stats.fwd_unreachable;
+  stats.fwd_frag_needed += fwd_stats.fwd_frag_needed;
+  stats.fwd_drops += fwd_stats.fwd_drops;
+  mutex_unlock(&mutex);
+  memset(&fwd_stats, 0, sizeof(fwd_stats));
+}
+
+void ip_get_stats(struct ip_stats *dst) {
+  mutex_lock(&mutex);
+  *dst = stats;
+  mutex_unlock(&mutex);
+}
+
 int ip_init(void) {
   if (net_protocol_register(NET_PROTOCOL_TYPE_IP, ip_input) == -1) {
     errorf("net_protocol_register() failure");
     return -1;
   }
+  if (net_protocol_register_gro(NET_PROTOCOL_TYPE_IP, ip_gro_receive, ip_gro_hold) == -1) {
+    errorf("net_protocol_register_gro() failure");
+    return -1;
+  }
+  if (net_protocol_register_early(NET_PROTOCOL_TYPE_IP, ip_early_input, ip_early_complete) == -1) {
+    errorf("net_protocol_register_early() failure");
+    return -1;
+  }
+  struct timeval interval = {60, 0};
+  if (net_timer_register(interval, ip_pmtu_timer_handler) == -1) {
+    errorf("net_timer_register() failure");
+    return -1;
+  }
   return 0;
 }
@@ -49,16 +49,117 @@ extern int ip_endpoint_pton(const char *p, struct ip_endpoint *n);
 extern char *ip_endpoint_ntop(const struct ip_endpoint *n, char *p, size_t size);
 
 extern int ip_route_set_default_gateway(struct ip_iface *iface, const char *gateway);
+extern int ip_route_add_prefix(ip_addr_t network, ip_addr_t netmask, ip_addr_t nexthop, struct ip_iface *iface);
 extern struct ip_iface *ip_route_get_iface(ip_addr_t dst);
+/* path MTU toward dst, at most the MTU of the device of the route, 0 if no route */
+extern uint16_t ip_route_get_mtu(ip_addr_t dst);
+/* lowers the path MTU toward dst (never below 552), for a Fragmentation Needed checked by the protocol */
+extern void ip_route_update_mtu(ip_addr_t dst, uint16_t mtu);
+/* the search through the list of routes, as the reference for the routing table */
+extern struct ip_iface *ip_route_get_iface_linear(ip_addr_t dst);
+/* chunks of 256 slots allocated by the routing table below the 65536 root slots */
+extern size_t ip_route_table_chunks(void);
 
 extern struct ip_iface *ip_iface_alloc(const char *addr, const char *netmask);
 extern int ip_iface_register(struct net_device *dev, struct ip_iface *iface);
 extern struct ip_iface *ip_iface_select(ip_addr_t addr);
 
+/* IP header prebuilt for a flow whose addresses and protocol never change, see ip_output_template() */
+struct ip_hdr_template {
+  uint8_t hdr[IP_HDR_SIZE_MIN]; /* the total length, the id and the checksum are patched for each datagram */
+  uint16_t sum;                 /* partial sum of the header without the total length and the id */
+  uint16_t psum;                /* partial sum of the pseudo header without the length, for the transport checksum */
+};
+
+/* route and link address resolved for a destination, see ip_output_dst() */
+struct ip_dst_cache {
+  unsigned int gen; /* generation of the routes and neighbors it was resolved with, 0 if not resolved */
+  struct ip_iface *iface;
+  ip_addr_t nexthop;
+  uint8_t hwaddr[NET_DEVICE_ADDR_LEN];
+  uint16_t mtu;       /* path MTU, a datagram with DF set and longer than this is refused */
+  unsigned int stale; /* see arp_stale_generation(), 0 if the link address is not resolved by ARP */
+};
+
+/* segmentation hint for a transport segment larger than the MTU, see ip_output_gso() */
+struct ip_gso {
+  uint16_t size; /* payload bytes of each frame */
+  uint16_t hlen; /* transport header replicated on each frame */
+  /* patches the replicated header, given the offset in the original segment and the partial sum of the pseudo header
+   * and the frame payload */
+  void (*fixup)(uint8_t *seg, size_t len, size_t offset, int last, uint32_t sum);
+};
+
+extern void ip_hdr_template_init(struct ip_hdr_template *tmpl, uint8_t protocol, ip_addr_t src, ip_addr_t dst);
+/* sets DF on the datagrams of the template, for path MTU discovery, see https://tools.ietf.org/html/rfc1191 */
+extern void ip_hdr_template_set_df(struct ip_hdr_template *tmpl);
+/* returns the partial sum of the pseudo header of a transport segment of len bytes */
+extern uint32_t ip_hdr_template_psum(const struct ip_hdr_template *tmpl, size_t len);
+
 extern ssize_t ip_output(uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst);
+extern ssize_t ip_output_gso(uint8_t protocol, const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst,
+                             const struct ip_gso *gso);
+extern ssize_t ip_output_template(const struct ip_hdr_template *tmpl, const uint8_t *data, size_t len,
+                                  const struct ip_gso *gso);
+extern ssize_t ip_output_dst(struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl, const uint8_t *data,
+                             size_t len, const struct ip_gso *gso);
+/*
+ * same as ip_output_dst() with the transport header (gso->hlen bytes) and the payload given apart, the payload is
+ * copied only into the frames. Always segmented by gso, whose size must cover the payload (if any) to send one frame.
+ */
+extern ssize_t ip_output_dst_sg(struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl, const uint8_t *hdr,
+                                const uint8_t *data, size_t len, const struct ip_gso *gso);
+/* invalidates every destination cache, called when a route or a link address changes */
+extern void ip_dst_cache_invalidate(void);
 
 extern int ip_protocol_register(uint8_t type, void (*handler)(const uint8_t *data, size_t len, ip_addr_t src,
                                                               ip_addr_t dst, struct ip_iface *iface));
+/* see net_protocol_register_gro(), held and data are the payloads of datagrams between the same src and dst */
+extern int ip_protocol_register_gro(uint8_t type,
+                                    int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data,
+                                               size_t dlen, ip_addr_t src, ip_addr_t dst, unsigned int count));
+/*
+ * called for an ICMP error about a datagram of the protocol, data is its transport header (at least 8 bytes) and
+ * src/dst are its addresses, info is the 32-bit field following the checksum of the ICMP header. For Fragmentation
+ * Needed, info is the next-hop MTU (estimated if the router has not told it), which is not applied until the protocol
+ * has checked that the error is about a datagram in flight and passed it to ip_route_update_mtu().
+ */
+extern int ip_protocol_register_err(uint8_t type, void (*err)(const uint8_t *data, size_t len, ip_addr_t src,
+                                                              ip_addr_t dst, uint8_t type, uint8_t code,
+                                                              uint32_t info));
+/*
+ * called before the handler for a datagram to one of our addresses, reflect may rewrite data (the payload, in the
+ * buffer it has been received in) into the reply to be sent back to src and return 1, or return 0 to leave it to the
+ * handler untouched, or -1 to drop it
+ */
+extern int ip_protocol_register_reflect(uint8_t type, int (*reflect)(uint8_t *data, size_t len, ip_addr_t src,
+                                                                      ip_addr_t dst, struct ip_iface *iface));
+extern void ip_input(const uint8_t *data, size_t len, struct net_device *dev);
+
+/* called by ICMP with the datagram returned in an error message */
+extern void ip_error_input(uint8_t type, uint8_t code, uint32_t info, const uint8_t *data, size_t len);
+
+struct ip_stats {
+  uint64_t frags_in;          /* fragments received */
+  uint64_t reassembled;       /* datagrams put together from the fragments */
+  uint64_t reass_timeouts;    /* datagrams dropped still incomplete */
+  uint64_t reass_drops;       /* datagrams dropped for overlapping fragments, or to keep under the memory cap */
+  uint64_t fragmented;        /* datagrams sent in fragments */
+  uint64_t frags_out;         /* fragments sent */
+  uint64_t pmtu_updates;      /* path MTUs lowered by Fragmentation Needed */
+  uint64_t frag_needed;       /* datagrams with DF set refused for exceeding the path MTU */
+  uint64_t forwarded;         /* datagrams forwarded to another host */
+  uint64_t fwd_batches;       /* batches of forwarded datagrams passed to an egress device */
+  uint64_t fwd_time_exceeded; /* Time Exceeded sent for forwarded datagrams whose TTL has run out */
+  uint64_t fwd_unreachable;   /* Destination Unreachable sent for forwarded datagrams with no route or neighbor */
+  uint64_t fwd_frag_needed;   /* Fragmentation Needed sent for forwarded datagrams with DF set over the MTU */
+  uint64_t fwd_drops;         /* forwarded datagrams dropped without an error, e.g. while resolving the link address */
+};
+
+extern void ip_get_stats(struct ip_stats *stats);
+
+/* forwards the datagrams for other hosts between the interfaces (off by default), must be called before net_run() */
+extern void ip_set_forwarding(int enable);
 
 extern int ip_init(void);
 
@@ -20,14 +20,32 @@ struct net_protocol {
   uint16_t type;
   struct queue_head queue; /* input queue */
   void (*handler)(const uint8_t *data, size_t len, struct net_device *dev);
+  int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data, size_t dlen, unsigned int count);
+  int (*hold)(const uint8_t *data, size_t len);
+  int (*early)(uint8_t *data, size_t len, struct net_device *dev);
+  void (*complete)(void);
 };
 
 struct net_protocol_queue_entry {
   struct net_device *dev;
   size_t len;
+  uint8_t room[NET_DEVICE_HDR_ROOM]; /* for the link header when the packet is sent again */
   uint8_t data[];
 };
 
+#define NET_GRO_SIZE_MAX UINT16_MAX
+
+#define NET_PROTOCOL_TABLE_SIZE 16 /* NOTE: must be a power of 2 */
+#define NET_PROTOCOL_HASH(x) (((x) ^ ((x) >> 8)) & (NET_PROTOCOL_TABLE_SIZE - 1))
+
+/* packet held by the GRO stage of the softirq, to merge the following ones into */
+struct net_gro {
+  struct net_device *dev; /* NULL if nothing is held */
+  unsigned int count;     /* packets merged */
+  size_t len;
+  uint8_t data[NET_GRO_SIZE_MAX];
+};
+
 struct net_timer {
   struct net_timer *next;
   struct timeval interval;
@@ -44,9 +62,15 @@ struct net_event {
 /* NOTE: if you want to add/delete the entries after net_run(), you need to protect these lists with a mutex. */
 static struct net_device *devices;
 static struct net_protocol *protocols;
+static struct net_protocol *protocol_table[NET_PROTOCOL_TABLE_SIZE]; /* open addressing on the type */
 static struct net_timer *timers;
 static struct net_event *events;
 
+static struct net_gro gro; /* NOTE: used only by the softirq */
+
+static mutex_t timeouts_mutex = MUTEX_INITIALIZER;
+static struct net_timeout *timeouts; /* pending one-shot timers, sorted by expire */
+
 struct net_device *net_device_alloc(void) {
   struct net_device *dev;
 
@@ -149,15 +173,61 @@ int net_device_output(struct net_device *dev, uint16_t type, const uint8_t *data
   return 0;
 }
 
+int net_device_output_inplace(struct net_device *dev, uint16_t type, uint8_t *data, size_t len, const void *dst) {
+  if (!dev->ops->transmit_inplace || dev->hlen > NET_DEVICE_HDR_ROOM) {
+    return net_device_output(dev, type, data, len, dst);
+  }
+  if (!NET_DEVICE_IS_UP(dev)) {
+    errorf("not opened, dev=%s", dev->name);
+    return -1;
+  }
+  if (len > dev->mtu) {
+    errorf("too long, dev=%s, mtu=%u, len=%zu", dev->name, dev->mtu, len);
+    return -1;
+  }
+  debugf("dev=%s, type=0x%04x, len=%zu", dev->name, type, len);
+  debugdump(data, len);
+
+  if (dev->ops->transmit_inplace(dev, type, data, len, dst) == -1) {
+    errorf("device transmit failure, dev=%s, len=%zu", dev->name, len);
+    return -1;
+  }
+  return 0;
+}
+
+/* returns the slot of type in the table, or the empty slot it would take (NULL if the table is full) */
+static struct net_protocol **net_protocol_slot(uint16_t type) {
+  unsigned int i, n;
+
+  i = NET_PROTOCOL_HASH(type);
+  for (n = 0; n < NET_PROTOCOL_TABLE_SIZE; n++) {
+    if (!protocol_table[i] || protocol_table[i]->type == type) {
+      return &protocol_table[i];
+    }
+    i = (i + 1) & (NET_PROTOCOL_TABLE_SIZE - 1);
+  }
+  return NULL;
+}
+
+static struct net_protocol *net_protocol_lookup(uint16_t type) {
+  struct net_protocol **slot;
+
+  slot = net_protocol_slot(type);
+  return slot ? *slot : NULL;
+}
+
 /* NOTE: must not be call after net_run() */
 int net_protocol_register(uint16_t type, void (*handler)(const uint8_t *data, size_t len, struct net_device *dev)) {
-  struct net_protocol *proto;
+  struct net_protocol **slot, *proto;
 
-  for (proto = protocols; proto; proto = proto->next) {
-    if (type == proto->type) {
-      errorf("already registered, type=0x%04x", type);
-      return -1;
-    }
+  slot = net_protocol_slot(type);
+  if (!slot) {
+    errorf("too many protocols, type=0x%04x", type);
+    return -1;
+  }
+  if (*slot) {
+    errorf("already registered, type=0x%04x", type);
+    return -1;
   }
 
   proto = memory_alloc(sizeof(*proto));
@@ -169,10 +239,50 @@ int net_protocol_register(uint16_t type, void (*handler)(const uint8_t *data, si
   proto->handler = handler;
   proto->next = protocols;
   protocols = proto;
+  *slot = proto;
+  infof("registered, type=0x%04x", type);
+  return 0;
+}
+
+/* NOTE: must not be call after net_run() */
+int net_protocol_register_gro(uint16_t type,
+                              int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data, size_t dlen,
+                                         unsigned int count),
+                              int (*hold)(const uint8_t *data, size_t len)) {
+  struct net_protocol *proto;
+
+  proto = net_protocol_lookup(type);
+  if (!proto) {
+    errorf("not registered, type=0x%04x", type);
+    return -1;
+  }
+  proto->gro = gro;
+  proto->hold = hold;
   infof("registered, type=0x%04x", type);
   return 0;
 }
 
+/* NOTE: must not be call after net_run() */
+int net_protocol_register_early(uint16_t type, int (*early)(uint8_t *data, size_t len, struct net_device *dev),
+                                void (*complete)(void)) {
+  struct net_protocol *proto;
+
+  proto = net_protocol_lookup(type);
+  if (!proto) {
+    errorf("not registered, type=0x%04x", type);
+    return -1;
+  }
+  proto->early = early;
+  proto->complete = complete;
+  infof("registered, type=0x%04x", type);
+  return 0;
+}
+
+/* NOTE: data must be a packet taken by an early handler, see net_protocol_register_early() */
+void net_input_release(uint8_t *data) {
+  memory_free(data - offsetof(struct net_protocol_queue_entry, data));
+}
+
 /* NOTE: must not be call after net_run() */
 int net_timer_register(struct timeval interval, void (*handler)(void)) {
   struct net_timer *timer;
@@ -196,7 +306,10 @@ int net_timer_register(struct timeval interval, void (*handler)(void)) {
 
 int net_timer_handler(void) {
   struct net_timer *timer;
+  struct net_timeout *timeout;
   struct timeval now, diff;
+  void (*handler)(void *arg);
+  void *arg;
 
   for (timer = timers; timer; timer = timer->next) {
     gettimeofday(&now, NULL);
@@ -207,40 +320,160 @@ int net_timer_handler(void) {
     }
   }
 
+  gettimeofday(&now, NULL);
+  while (1) {
+    mutex_lock(&timeouts_mutex);
+    timeout = timeouts;
+    if (!timeout || timercmp(&timeout->expire, &now, >)) {
+      mutex_unlock(&timeouts_mutex);
+      break;
+    }
+    timeouts = timeout->next;
+    timeout->next = NULL;
+    timeout->pending = 0;
+    handler = timeout->handler;
+    arg = timeout->arg;
+    /* NOTE: the handler may take other locks and arm timeouts, so it is called after unlocked */
+    mutex_unlock(&timeouts_mutex);
+    handler(arg);
+  }
+
   return 0;
 }
 
+/*
+ * One-shot Timer
+ *
+ * NOTE: the owner must cancel a timeout before releasing its memory. As the handler can already be running when the
+ * timeout is cancelled or armed again, the handler must check that its work is still due.
+ */
+
+void net_timeout_init(struct net_timeout *timeout, void (*handler)(void *arg), void *arg) {
+  memset(timeout, 0, sizeof(*timeout));
+  timeout->handler = handler;
+  timeout->arg = arg;
+}
+
+/* NOTE: must be called after timeouts_mutex locked */
+static void net_timeout_unlink(struct net_timeout *timeout) {
+  struct net_timeout **p;
+
+  for (p = &timeouts; *p; p = &(*p)->next) {
+    if (*p == timeout) {
+      *p = timeout->next;
+      break;
+    }
+  }
+  timeout->next = NULL;
+  timeout->pending = 0;
+}
+
+void net_timeout_arm(struct net_timeout *timeout, const struct timeval *expire) {
+  struct net_timeout **p;
+
+  mutex_lock(&timeouts_mutex);
+  if (timeout->pending) {
+    net_timeout_unlink(timeout);
+  }
+  timeout->expire = *expire;
+  for (p = &timeouts; *p && !timercmp(&(*p)->expire, expire, >); p = &(*p)->next)
+    ;
+  timeout->next = *p;
+  *p = timeout;
+  timeout->pending = 1;
+  mutex_unlock(&timeouts_mutex);
+}
+
+void net_timeout_cancel(struct net_timeout *timeout) {
+  mutex_lock(&timeouts_mutex);
+  if (timeout->pending) {
+    net_timeout_unlink(timeout);
+  }
+  mutex_unlock(&timeouts_mutex);
+}
+
+int net_timeout_pending(struct net_timeout *timeout) {
+  int pending;
+
+  mutex_lock(&timeouts_mutex);
+  pending = timeout->pending;
+  mutex_unlock(&timeouts_mutex);
+  return pending;
+}
+
 int net_input_handler(uint16_t type, const uint8_t *data, size_t len, struct net_device *dev) {
   struct net_protocol *proto;
+  struct net_protocol_queue_entry *entry;
 
-  for (proto = protocols; proto; proto = proto->next) {
-    if (proto->type == type) {
-      struct net_protocol_queue_entry *entry;
-      entry = memory_alloc(sizeof(*entry) + len);
-      if (!entry) {
-        errorf("memory_alloc() failure");
-        return -1;
-      }
+  proto = net_protocol_lookup(type);
+  if (!proto) {
+    /* unsupported protocol */
+    return 0;
+  }
+  entry = memory_alloc(sizeof(*entry) + len);
+  if (!entry) {
+    errorf("memory_alloc() failure");
+    return -1;
+  }
 
-      entry->dev = dev;
-      entry->len = len;
-      memcpy(entry->data, data, len);
-      if (!queue_push(&proto->queue, entry)) {
-        errorf("queue_push() failure");
-        memory_free(entry);
-        return -1;
-      }
+  entry->dev = dev;
+  entry->len = len;
+  memcpy(entry->data, data, len);
+  if (!queue_push(&proto->queue, entry)) {
+    errorf("queue_push() failure");
+    memory_free(entry);
+    return -1;
+  }
 
-      debugf("queue pushed (num:%u), dev=%s, type=0x%04x, len=%zu", proto->queue.num, dev->name, type, len);
-      debugdump(data, len);
+  debugf("queue pushed (num:%u), dev=%s, type=0x%04x, len=%zu", proto->queue.num, dev->name, type, len);
+  debugdump(data, len);
 
-      intr_raise_irq(INTR_IRQ_SOFTIRQ);
-      return 0;
-    }
+  intr_raise_irq(INTR_IRQ_SOFTIRQ);
+  return 0;
+}
+
+static void net_protocol_deliver(struct net_protocol *proto, const uint8_t *data, size_t len, struct net_device *dev) {
+#ifdef NET_STATIC_DISPATCH
+  /* NOTE: direct calls so that the compiler can inline the common path, see net.h */
+  switch (proto->type) {
+    case NET_PROTOCOL_TYPE_IP:
+      ip_input(data, len, dev);
+      return;
+    case NET_PROTOCOL_TYPE_ARP:
+      arp_input(data, len, dev);
+      return;
   }
-  /* unsupported protocol */
+#endif
+  proto->handler(data, len, dev);
+}
 
-  return 0;
+static void net_gro_flush(struct net_protocol *proto) {
+  if (!gro.dev) {
+    return;
+  }
+  debugf("flush, dev=%s, type=0x%04x, len=%zu, count=%u", gro.dev->name, proto->type, gro.len, gro.count);
+  net_protocol_deliver(proto, gro.data, gro.len, gro.dev);
+  gro.dev = NULL;
+}
+
+/*
+ * Generic receive offload: the packets queued since the last softirq are processed as a batch, and consecutive ones
+ * that the protocol can merge are passed to the handler as one packet.
+ */
+static void net_gro_receive(struct net_protocol *proto, struct net_protocol_queue_entry *entry) {
+  if (gro.dev == entry->dev && proto->gro(gro.data, &gro.len, sizeof(gro.data), entry->data, entry->len, gro.count)) {
+    gro.count++;
+    return;
+  }
+  net_gro_flush(proto);
+  if (!proto->hold(entry->data, entry->len)) {
+    net_protocol_deliver(proto, entry->data, entry->len, entry->dev); /* nothing could be merged into it */
+    return;
+  }
+  gro.dev = entry->dev;
+  gro.count = 1;
+  gro.len = entry->len;
+  memcpy(gro.data, entry->data, entry->len);
 }
 
 int net_softirq_handler(void) {
@@ -256,9 +489,22 @@ int net_softirq_handler(void) {
       debugf("queue popped (num:%u), dev=%s, type=0x%04x, len=%zu", proto->queue.num, entry->dev->name, proto->type,
              entry->len);
       debugdump(entry->data, entry->len);
-      proto->handler(entry->data, entry->len, entry->dev);
+      if (proto->early && proto->early(entry->data, entry->len, entry->dev)) {
+        continue; /* NOTE: taken without a copy, released by the protocol */
+      }
+      if (proto->gro) {
+        net_gro_receive(proto, entry);
+      } else {
+        net_protocol_deliver(proto, entry->data, entry->len, entry->dev);
+      }
       memory_free(entry);
     }
+    if (proto->gro) {
+      net_gro_flush(proto); /* end of the batch */
+    }
+    if (proto->complete) {
+      proto->complete();
+    }
   }
 
   return 0;
@@ -21,10 +21,16 @@
 #define NET_DEVICE_FLAG_NEED_ARP 0x0100
 
 #define NET_DEVICE_ADDR_LEN 16
+#define NET_DEVICE_HDR_ROOM 16 /* bytes kept in front of a received packet, see net_device_output_inplace() */
 
 #define NET_DEVICE_IS_UP(x) ((x)->flags & NET_DEVICE_FLAG_UP)
 #define NET_DEVICE_STATE(x) (NET_DEVICE_IS_UP(x) ? "up" : "down")
 
+/*
+ * NOTE: input handlers are looked up per packet in the protocol tables, build with -DNET_STATIC_DISPATCH (and -flto)
+ * to call the ones of IP, ARP, TCP, UDP and ICMP directly instead, e.g. `make STATIC_DISPATCH=1`
+ */
+
 /* NOTE: use same value as the Ethernet types */
 #define NET_PROTOCOL_TYPE_IP 0x0800
 #define NET_PROTOCOL_TYPE_ARP 0x0806
@@ -59,6 +65,8 @@ struct net_device_ops {
   int (*open)(struct net_device *dev);
   int (*close)(struct net_device *dev);
   int (*transmit)(struct net_device *dev, uint16_t type, const uint8_t *data, size_t len, const void *dst);
+  /* optional, writes the link header in the hlen bytes in front of data, see net_device_output_inplace() */
+  int (*transmit_inplace)(struct net_device *dev, uint16_t type, uint8_t *data, size_t len, const void *dst);
 };
 
 struct net_iface {
@@ -73,13 +81,49 @@ extern int net_device_register(struct net_device *dev);
 extern int net_device_add_iface(struct net_device *dev, struct net_iface *iface);
 extern struct net_iface *net_device_get_iface(struct net_device *dev, int family);
 extern int net_device_output(struct net_device *dev, uint16_t type, const uint8_t *data, size_t len, const void *dst);
+/*
+ * same as net_device_output() for a packet taken by an early handler, see net_protocol_register_early(). The link
+ * header is written in front of it and the frame is passed to the device without a copy, if the device supports it.
+ */
+extern int net_device_output_inplace(struct net_device *dev, uint16_t type, uint8_t *data, size_t len, const void *dst);
 
 extern int net_protocol_register(uint16_t type,
                                  void (*handler)(const uint8_t *data, size_t len, struct net_device *dev));
+/*
+ * merges data into held, a packet of the same protocol received just before, returns 1 if merged.
+ * count is the number of packets already merged into held (1 if held is as received).
+ * hold returns 1 if the packet may have the following ones merged into it, the others are delivered without a copy.
+ */
+extern int net_protocol_register_gro(uint16_t type,
+                                     int (*gro)(uint8_t *held, size_t *len, size_t size, const uint8_t *data,
+                                                size_t dlen, unsigned int count),
+                                     int (*hold)(const uint8_t *data, size_t len));
+
+/*
+ * early is called for each packet before the GRO stage, and returns 1 if it has taken the packet, whose buffer is then
+ * kept as received until passed to net_input_release(). complete is called at the end of each batch of the softirq.
+ */
+extern int net_protocol_register_early(uint16_t type, int (*early)(uint8_t *data, size_t len, struct net_device *dev),
+                                       void (*complete)(void));
+extern void net_input_release(uint8_t *data);
+
+/* one-shot timer, embedded in its owner and (re)armed or cancelled at any time */
+struct net_timeout {
+  struct net_timeout *next;
+  struct timeval expire;
+  int pending;
+  void (*handler)(void *arg); /* NOTE: called from the timer context, after the timeout is no longer pending */
+  void *arg;
+};
 
 extern int net_timer_register(struct timeval interval, void (*handler)(void));
 extern int net_timer_handler(void);
 
+extern void net_timeout_init(struct net_timeout *timeout, void (*handler)(void *arg), void *arg);
+extern void net_timeout_arm(struct net_timeout *timeout, const struct timeval *expire);
+extern void net_timeout_cancel(struct net_timeout *timeout);
+extern int net_timeout_pending(struct net_timeout *timeout);
+
 extern int net_input_handler(uint16_t type, const uint8_t *data, size_t len, struct net_device *dev);
 extern int net_softirq_handler(void);
 
@@ -24,6 +24,7 @@
 #define CLONE_DEVICE "/dev/net/tun"
 
 #define ETHER_TAP_IRQ (INTR_IRQ_BASE + 2)
+#define ETHER_TAP_BUDGET 64 /* frames read in a run of the isr */
 
 struct ether_tap {
   char name[IFNAMSIZ];
@@ -113,6 +114,10 @@ int ether_tap_transmit(struct net_device *dev, uint16_t type, const uint8_t *buf
   return ether_transmit_helper(dev, type, buf, len, dst, ether_tap_write);
 }
 
+int ether_tap_transmit_inplace(struct net_device *dev, uint16_t type, uint8_t *buf, size_t len, const void *dst) {
+  return ether_transmit_inplace_helper(dev, type, buf, len, dst, ether_tap_write);
+}
+
 static ssize_t ether_tap_read(struct net_device *dev, uint8_t *buf, size_t size) {
   ssize_t len;
 
@@ -126,11 +131,14 @@ static ssize_t ether_tap_read(struct net_device *dev, uint8_t *buf, size_t size)
   return len;
 }
 
+/*
+ * NOTE: reads up to ETHER_TAP_BUDGET frames and raises the irq again if more are pending, so that the softirq (raised
+ * by the frames read) processes them in between. Otherwise a flood keeps the isr reading and the softirq never runs.
+ */
 static int ether_tap_isr(unsigned int irq, void *id) {
   struct net_device *dev;
-  ;
   struct pollfd pfd;
-  int ret;
+  int ret, budget = ETHER_TAP_BUDGET;
 
   dev = (struct net_device *)id;
   pfd.fd = PRIV(dev)->fd;
@@ -148,6 +156,10 @@ static int ether_tap_isr(unsigned int irq, void *id) {
       /* No frames to input immediately. */
       break;
     }
+    if (!budget--) {
+      intr_raise_irq(irq);
+      break;
+    }
     ether_input_helper(dev, ether_tap_read);
   }
   return 0;
@@ -157,6 +169,7 @@ static struct net_device_ops ether_tap_ops = {
     .open = ether_tap_open,
     .close = ether_tap_close,
     .transmit = ether_tap_transmit,
+    .transmit_inplace = ether_tap_transmit_inplace,
 };
 
 struct net_device *ether_tap_init(const char *name, const char *addr) {
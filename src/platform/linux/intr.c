@@ -109,6 +109,15 @@ static void *intr_thread(void *arg) {
       case SIGUSR2:
         net_event_handler();
         break;
+      case SIGIO:
+        /*
+         * NOTE: the kernel falls back to SIGIO when the queue of F_SETSIG realtime signals overflows, which means some
+         * device IRQs were lost. Poll every handler once so that no device is left with unread frames.
+         */
+        for (entry = irqs; entry; entry = entry->next) {
+          entry->handler(entry->irq, entry->dev);
+        }
+        break;
       default:
         for (entry = irqs; entry; entry = entry->next) {
           if (entry->irq == (unsigned int)sig) {
@@ -157,5 +166,6 @@ int intr_init(void) {
   sigaddset(&sigmask, SIGUSR1);
   sigaddset(&sigmask, SIGUSR2);
   sigaddset(&sigmask, SIGALRM);
+  sigaddset(&sigmask, SIGIO);
   return 0;
 }
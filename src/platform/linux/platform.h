@@ -4,7 +4,10 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/random.h>
+#include <time.h>
 
 /*
  * Memory
@@ -14,6 +17,27 @@ static inline void *memory_alloc(size_t size) { return calloc(1, size); }
 
 static inline void memory_free(void *ptr) { free(ptr); }
 
+/*
+ * Random
+ */
+
+static inline int random_bytes(void *buf, size_t len) { return getrandom(buf, len, 0) == (ssize_t)len ? 0 : -1; }
+
+/*
+ * Cycle Counter
+ */
+
+static inline uint64_t cycle_counter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts; /* nanoseconds instead of cycles */
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
 /*
  * Mutex
  */
@@ -28,6 +52,49 @@ static inline int mutex_lock(mutex_t *mutex) { return pthread_mutex_lock(mutex);
 
 static inline int mutex_unlock(mutex_t *mutex) { return pthread_mutex_unlock(mutex); }
 
+/*
+ * Atomic
+ */
+
+static inline unsigned int atomic_read(const unsigned int *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+static inline void atomic_write(unsigned int *p, unsigned int v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+static inline unsigned int atomic_inc(unsigned int *p) { return __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL); }
+
+static inline uintptr_t atomic_read_ptr(const uintptr_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+static inline void atomic_write_ptr(uintptr_t *p, uintptr_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+/*
+ * Seqlock
+ *
+ * NOTE: the writers are serialized by a mutex of their own, the readers take no lock and read again if a write has
+ * happened meanwhile. What is read must be copied out and used only once seqlock_read_retry() has returned 0.
+ */
+
+typedef unsigned int seqlock_t;
+
+static inline unsigned int seqlock_read_begin(const seqlock_t *seq) {
+  unsigned int start;
+
+  while ((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+    ; /* a write is in progress */
+  return start;
+}
+
+static inline int seqlock_read_retry(const seqlock_t *seq, unsigned int start) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void seqlock_write_begin(seqlock_t *seq) {
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(seqlock_t *seq) { __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE); }
+
 /*
  * Interrupt
  */
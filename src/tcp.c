@@ -7,10 +7,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include "icmp.h"
 #include "ip.h"
 #include "platform.h"
+#include "tcp_cc.h"
 #include "util.h"
 
 #define TCP_FLG_FIN 0x01
@@ -23,6 +28,14 @@
 #define TCP_FLG_IS(x, y) ((x & 0x3f) == (y))
 #define TCP_FLG_ISSET(x, y) ((x & 0x3f) & (y) ? 1 : 0)
 
+/* NOTE: sequence numbers wrap around, they are compared by the sign of the difference, see rfc1982 */
+#define TCP_SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+#define TCP_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define TCP_SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+#define TCP_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+#define TCP_SEQ_MIN(a, b) (TCP_SEQ_LT(a, b) ? (a) : (b))
+#define TCP_SEQ_MAX(a, b) (TCP_SEQ_GT(a, b) ? (a) : (b))
+
 #define TCP_PCB_SIZE 16
 
 #define TCP_PCB_STATE_FREE 0
@@ -39,7 +52,40 @@
 #define TCP_PCB_STATE_LAST_ACK 11
 
 #define TCP_DEFAULT_RTO 200000     /* micro seconds */
+#define TCP_MIN_RTO 200000         /* micro seconds */
 #define TCP_RETRANSMIT_DEADLINE 12 /* seconds */
+#define TCP_PERSIST_MAX 60000000   /* micro seconds, interval between zero window probes */
+#define TCP_TLP_DELACK 200000      /* micro seconds, worst case delayed ACK waited for a single segment in flight */
+
+#define TCP_DEFAULT_MSS 536     /* see https://tools.ietf.org/html/rfc1122 */
+#define TCP_PACING_QUANTUM 1000 /* micro seconds, burst allowed ahead of the pacing schedule */
+
+#define TCP_OPT_EOL 0
+#define TCP_OPT_NOP 1
+#define TCP_OPT_MSS 2
+#define TCP_OPT_WSCALE 3
+#define TCP_OPT_SACK_PERMITTED 4
+#define TCP_OPT_SACK 5
+#define TCP_OPT_FASTOPEN 34
+
+#define TCP_OPT_LEN_MAX 40
+
+#define TCP_FASTOPEN_COOKIE_LEN 8
+#define TCP_FASTOPEN_COOKIE_LEN_MIN 4
+#define TCP_FASTOPEN_COOKIE_LEN_MAX 16
+#define TCP_FASTOPEN_CACHE_SIZE 16
+
+#define TCP_METRICS_CACHE_SIZE 64
+#define TCP_METRICS_TIMEOUT 3600 /* seconds, to forget a destination not talked to */
+
+#define TCP_SACK_BLOCKS_MAX 4 /* in an option */
+#define TCP_SACK_SCOREBOARD 8 /* blocks remembered per connection */
+
+#define TCP_RCVBUF_INIT 16384                /* bytes */
+#define TCP_RCVBUF_MAX (4 * 1024 * 1024)     /* bytes */
+#define TCP_RCVBUF_BUDGET (16 * 1024 * 1024) /* bytes, shared by all connections */
+#define TCP_RCVBUF_IDLE 1                    /* seconds, to release the memory of an idle connection */
+#define TCP_RCV_WSCALE 7 /* 65535 << 7 covers TCP_RCVBUF_MAX, see https://tools.ietf.org/html/rfc7323 */
 
 struct pseudo_hdr {
   uint32_t src;
@@ -61,52 +107,164 @@ struct tcp_hdr {
   uint16_t up;
 };
 
+/* headers of the segments of a connection, built once the endpoints are fixed */
+struct tcp_hdr_template {
+  struct ip_hdr_template ip;
+  struct tcp_hdr tcp; /* ports only, the other fields are filled for each segment */
+};
+
+struct tcp_sack_block {
+  uint32_t left;
+  uint32_t right;
+};
+
+struct tcp_options {
+  uint16_t mss; /* 0 if not present */
+  int wscale;   /* -1 if not present */
+  int fastopen; /* 1 if the Fast Open option is present */
+  uint8_t cookie_len;
+  uint8_t cookie[TCP_FASTOPEN_COOKIE_LEN_MAX];
+  int sack_permitted;
+  uint8_t sack_num;
+  struct tcp_sack_block sack[TCP_SACK_BLOCKS_MAX];
+};
+
 struct tcp_segment_info {
   uint32_t seq;
   uint32_t ack;
   uint16_t len;
   uint16_t wnd;
   uint16_t up;
+  struct tcp_options opt;
 };
 
 struct tcp_pcb {
   int state;
   struct ip_endpoint local;
   struct ip_endpoint foreign;
+  struct tcp_hdr_template tmpl;
+  struct ip_dst_cache dst;
   struct {
     uint32_t nxt;
     uint32_t una;
-    uint16_t wnd;
+    uint32_t wnd;
     uint16_t up;
     uint32_t wl1;
     uint32_t wl2;
+    uint8_t wscale; /* shift count of the window advertised by the peer */
   } snd;
   uint32_t iss;
   struct {
     uint32_t nxt;
-    uint16_t wnd;
+    uint32_t wnd;
     uint16_t up;
+    uint8_t wscale; /* shift count of the window we advertise, 0 if the peer does not scale */
+    uint32_t adv;   /* right edge of the window last advertised */
   } rcv;
   uint32_t irs;
   uint16_t mtu;
   uint16_t mss;
-  uint8_t buf[65535]; /* receive buffer */
+  struct timeval mss_lowered; /* when the MSS was last lowered to fit the path MTU */
+  uint32_t srtt;              /* micro seconds */
+  uint32_t rttvar;            /* micro seconds */
+  uint32_t rto;               /* micro seconds */
+  struct tcp_cc cc;
+  struct timeval pacing; /* earliest time to send the next segment */
+  uint64_t delivered;    /* total bytes acknowledged */
+  struct timeval delivered_time;
+  struct {
+    int option;         /* put the Fast Open option on SYN */
+    uint8_t cookie_len; /* 0 for a cookie request */
+    uint8_t cookie[TCP_FASTOPEN_COOKIE_LEN_MAX];
+    int accepted; /* the data carried by the SYN has been accepted (server) */
+  } fastopen;
+  struct {
+    uint8_t *data; /* ring buffer, rcv.wnd is the free space */
+    size_t size;
+    size_t head;          /* offset of the first byte not yet read by the application */
+    size_t copied;        /* bytes read by the application in the current measurement */
+    struct timeval stamp; /* start of the current measurement */
+    struct timeval last;  /* last time data arrived */
+    uint32_t rtt;         /* micro seconds, estimated by the receiver, 0 if no sample */
+    uint32_t rtt_seq;     /* right edge of the window when the RTT measurement started */
+    struct timeval rtt_stamp;
+    struct net_timeout idle; /* releases the memory of an idle connection */
+    size_t limit;            /* window offered at most while the buffer is being released, 0 if none */
+  } rcvbuf;
+  struct {
+    uint8_t *buf; /* lent by a reader blocked in tcp_receive(), NULL if none */
+    size_t size;
+    size_t len; /* bytes delivered into buf */
+  } reader;
   struct sched_ctx ctx;
-  struct queue_head queue; /* retransmit queue */
+  struct queue_head queue;       /* retransmit queue */
+  struct net_timeout retransmit; /* fires when the oldest entry of the retransmit queue times out */
+  struct net_timeout persist;    /* probes the zero window of the peer */
+  unsigned int persist_backoff;
+  struct queue_head zc; /* buffers lent by tcp_send_zc() in the order sent, completed ones have no reference */
+  struct {
+    int permitted; /* offered on our SYN, then agreed on by both ends */
+    int num;
+    struct tcp_sack_block blocks[TCP_SACK_SCOREBOARD]; /* sorted and merged, above snd.una */
+  } sack;
+  struct {
+    struct timeval xmit; /* transmit time of the most recently sent segment known to be delivered */
+    uint32_t end_seq;
+    uint32_t rtt;               /* micro seconds, of that segment */
+    uint32_t min_rtt;           /* micro seconds */
+    struct net_timeout reorder; /* fires when a segment outlives the reordering window */
+    struct net_timeout tlp;     /* tail loss probe */
+    int tlp_out;                /* a probe is outstanding */
+    uint32_t tlp_end;           /* snd.nxt when the probe was sent */
+    int recovering;
+    uint32_t recovery_end; /* snd.nxt when the recovery started */
+  } rack;
+};
+
+/* file mapping or lent buffer shared by the retransmit entries built by tcp_sendfile() or tcp_send_zc() */
+struct tcp_mapping {
+  int ref;
+  void *addr;
+  size_t len;
+  int lent;        /* the buffer of tcp_send_zc(), completed instead of unmapped when the last reference goes */
+  uint64_t cookie; /* reported by tcp_zc_reap() */
 };
 
 struct tcp_queue_entry {
   struct timeval first;
   struct timeval last;
   unsigned int rto; /* micro seconds */
+  unsigned int retransmits;
+  uint64_t delivered; /* pcb->delivered when sent */
+  struct timeval delivered_time;
   uint32_t seq;
   uint8_t flg;
   size_t len;
-  uint8_t data[];
+  uint8_t *data;           /* points to buf[] or into map */
+  struct tcp_mapping *map; /* NULL if the data is held in buf[] */
+  uint8_t buf[];
+};
+
+/* Fast Open cookies received from servers, see https://tools.ietf.org/html/rfc7413#section-4.1.3 */
+struct tcp_fastopen_cache {
+  ip_addr_t addr; /* 0 if free */
+  uint16_t mss;
+  uint8_t cookie_len;
+  uint8_t cookie[TCP_FASTOPEN_COOKIE_LEN_MAX];
+  struct timeval timestamp;
 };
 
 static mutex_t mutex = MUTEX_INITIALIZER;
 static struct tcp_pcb pcbs[TCP_PCB_SIZE];
+static const struct tcp_cc_ops *cc_default = &tcp_cc_reno;
+static struct tcp_stats stats;
+static uint64_t gro_merged; /* NOTE: counted by the softirq without the mutex, added to stats by tcp_input() */
+static size_t rcvbuf_total; /* bytes allocated for the receive buffers */
+static int fastopen = TCP_FASTOPEN_CLIENT;
+static uint8_t fastopen_key[SIPHASH_KEY_LEN];
+static uint8_t reuseport_key[SIPHASH_KEY_LEN];
+static struct tcp_fastopen_cache fastopen_caches[TCP_FASTOPEN_CACHE_SIZE];
+static struct tcp_metrics metrics_caches[TCP_METRICS_CACHE_SIZE];
 
 static char *tcp_flg_ntoa(uint8_t flg) {
   static char str[9];
@@ -138,12 +296,98 @@ static void tcp_dump(const uint8_t *data, size_t len) {
   funlockfile(stderr);
 }
 
+/*
+ * TCP Metrics
+ *
+ * NOTE: TCP Metrics functions must be called after mutex locked
+ */
+
+static struct tcp_metrics *tcp_metrics_select(ip_addr_t addr) {
+  struct tcp_metrics *entry;
+  struct timeval now, expire;
+
+  gettimeofday(&now, NULL);
+  for (entry = metrics_caches; entry < tailof(metrics_caches); entry++) {
+    if (entry->addr && entry->addr == addr) {
+      expire = entry->timestamp;
+      expire.tv_sec += TCP_METRICS_TIMEOUT;
+      if (timercmp(&now, &expire, >)) {
+        memset(entry, 0, sizeof(*entry)); /* stale, the path may have changed */
+        return NULL;
+      }
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* NOTE: called when a connection is released, the values of the last connection replace the older ones */
+static void tcp_metrics_save(struct tcp_pcb *pcb) {
+  struct tcp_metrics *entry, *oldest = NULL;
+  char addr1[IP_ADDR_STR_LEN];
+
+  if (!pcb->srtt || pcb->foreign.addr == IP_ADDR_ANY) {
+    return; /* nothing learned */
+  }
+  entry = tcp_metrics_select(pcb->foreign.addr);
+  if (!entry) {
+    for (entry = metrics_caches; entry < tailof(metrics_caches); entry++) {
+      if (!entry->addr) {
+        break;
+      }
+      if (!oldest || timercmp(&oldest->timestamp, &entry->timestamp, >)) {
+        oldest = entry;
+      }
+    }
+    if (entry == tailof(metrics_caches)) {
+      entry = oldest;
+    }
+  }
+  entry->addr = pcb->foreign.addr;
+  entry->srtt = pcb->srtt;
+  entry->rttvar = pcb->rttvar;
+  entry->ssthresh = pcb->cc.ssthresh == UINT32_MAX ? 0 : pcb->cc.ssthresh;
+  entry->cwnd = pcb->cc.cwnd;
+  entry->mtu = pcb->mss + IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr);
+  gettimeofday(&entry->timestamp, NULL);
+  debugf("UPDATE: addr=%s, srtt=%u, rttvar=%u, ssthresh=%u, cwnd=%u, mtu=%u",
+         ip_addr_ntop(entry->addr, addr1, sizeof(addr1)), entry->srtt, entry->rttvar, entry->ssthresh, entry->cwnd,
+         entry->mtu);
+}
+
+static void tcp_pcb_set_peer_mss(struct tcp_pcb *pcb, uint16_t mss);
+
+/* NOTE: called once the defaults of a connection are set, a known destination starts from what was learned */
+static void tcp_metrics_seed(struct tcp_pcb *pcb) {
+  struct tcp_metrics *entry;
+
+  entry = tcp_metrics_select(pcb->foreign.addr);
+  if (!entry) {
+    return;
+  }
+  pcb->srtt = entry->srtt;
+  pcb->rttvar = entry->rttvar;
+  pcb->rto = MAX(pcb->srtt + 4 * pcb->rttvar, TCP_MIN_RTO);
+  if (entry->ssthresh) {
+    pcb->cc.ssthresh = MAX(entry->ssthresh, TCP_CC_MIN_CWND * pcb->mss);
+  }
+  /* NOTE: only half of the last window, the path may be shared by more flows by now (see rfc9040 section 4) */
+  pcb->cc.cwnd = MAX(pcb->cc.cwnd, MIN(entry->cwnd / 2, pcb->cc.ssthresh));
+  tcp_pcb_set_peer_mss(pcb, entry->mtu - (IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr)));
+}
+
 /*
  * TCP Protocol Control Block (PCB)
  *
  * NOTE: TCP PCB functions must be called after mutex locked
  */
 
+static void tcp_retransmit_timeout(void *arg);
+static void tcp_persist_timeout(void *arg);
+static void tcp_rack_reorder_timeout(void *arg);
+static void tcp_tlp_timeout(void *arg);
+static void tcp_rcvbuf_idle_timeout(void *arg);
+
 static struct tcp_pcb *tcp_pcb_alloc(void) {
   struct tcp_pcb *pcb;
 
@@ -151,13 +395,21 @@ static struct tcp_pcb *tcp_pcb_alloc(void) {
     if (pcb->state == TCP_PCB_STATE_FREE) {
       pcb->state = TCP_PCB_STATE_CLOSED;
       sched_ctx_init(&pcb->ctx);
+      net_timeout_init(&pcb->retransmit, tcp_retransmit_timeout, pcb);
+      net_timeout_init(&pcb->persist, tcp_persist_timeout, pcb);
+      net_timeout_init(&pcb->rack.reorder, tcp_rack_reorder_timeout, pcb);
+      net_timeout_init(&pcb->rack.tlp, tcp_tlp_timeout, pcb);
+      net_timeout_init(&pcb->rcvbuf.idle, tcp_rcvbuf_idle_timeout, pcb);
       return pcb;
     }
   }
   return NULL;
 }
 
+static void tcp_retransmit_queue_discard(struct tcp_pcb *pcb);
+
 static void tcp_pcb_release(struct tcp_pcb *pcb) {
+  struct tcp_mapping *map;
   char ep1[IP_ENDPOINT_STR_LEN];
   char ep2[IP_ENDPOINT_STR_LEN];
 
@@ -165,13 +417,35 @@ static void tcp_pcb_release(struct tcp_pcb *pcb) {
     sched_wakeup(&pcb->ctx);
     return;
   }
+  tcp_metrics_save(pcb);
+  tcp_retransmit_queue_discard(pcb);
+  while ((map = queue_pop(&pcb->zc)) != NULL) {
+    memory_free(map); /* NOTE: no longer referenced, the cookies not reaped yet are never reported */
+  }
+  net_timeout_cancel(&pcb->persist);
+  net_timeout_cancel(&pcb->rack.reorder);
+  net_timeout_cancel(&pcb->rack.tlp);
+  net_timeout_cancel(&pcb->rcvbuf.idle);
+  memory_free(pcb->rcvbuf.data);
+  rcvbuf_total -= pcb->rcvbuf.size;
   debugf("released, local=%s, foreign=%s", ip_endpoint_ntop(&pcb->local, ep1, sizeof(ep1)),
          ip_endpoint_ntop(&pcb->foreign, ep2, sizeof(ep2)));
   memset(pcb, 0, sizeof(*pcb)); /* pcb->state is set to TCP_PCB_STATE_FREE (0) */
 }
 
+/* NOTE: keyed with a secret, the peers cannot aim their connections at one listener */
+static uint32_t tcp_flow_hash(struct ip_endpoint *local, struct ip_endpoint *foreign) {
+  uint32_t flow[3];
+
+  flow[0] = local->addr;
+  flow[1] = foreign->addr;
+  flow[2] = (uint32_t)local->port << 16 | foreign->port;
+  return siphash(reuseport_key, flow, sizeof(flow));
+}
+
 static struct tcp_pcb *tcp_pcb_select(struct ip_endpoint *local, struct ip_endpoint *foreign) {
-  struct tcp_pcb *pcb, *listen_pcb = NULL;
+  struct tcp_pcb *pcb, *listeners[TCP_PCB_SIZE];
+  int num = 0;
 
   for (pcb = pcbs; pcb < tailof(pcbs); pcb++) {
     if ((pcb->local.addr == IP_ADDR_ANY || pcb->local.addr == local->addr) && pcb->local.port == local->port) {
@@ -184,12 +458,20 @@ static struct tcp_pcb *tcp_pcb_select(struct ip_endpoint *local, struct ip_endpo
       if (pcb->state == TCP_PCB_STATE_LISTEN) {
         if (pcb->foreign.addr == IP_ADDR_ANY && pcb->foreign.port == 0) {
           /* LISTENed with wildcard foreign address/port */
-          listen_pcb = pcb;
+          listeners[num++] = pcb;
         }
       }
     }
   }
-  return listen_pcb;
+  if (num <= 1) {
+    return num ? listeners[0] : NULL;
+  }
+  /*
+   * NOTE: the listeners on the same endpoint form a reuseport group, e.g. one per worker thread.
+   * A flow hash picks one of them for the connection, so each thread is woken only for its own connections.
+   */
+  stats.reuseport_steered++;
+  return listeners[tcp_flow_hash(local, foreign) % num];
 }
 
 static struct tcp_pcb *tcp_pcb_get(int id) {
@@ -208,143 +490,1533 @@ static struct tcp_pcb *tcp_pcb_get(int id) {
 
 static int tcp_pcb_id(struct tcp_pcb *pcb) { return indexof(pcbs, pcb); }
 
-static ssize_t tcp_output_segment(uint32_t seq, uint32_t ack, uint8_t flg, uint16_t wnd, uint8_t *data, size_t len,
-                                  struct ip_endpoint *local, struct ip_endpoint *foreign) {
-  struct pseudo_hdr pseudo;
-  pseudo.src = local->addr;
-  pseudo.dst = foreign->addr;
-  pseudo.zero = 0;
-  pseudo.protocol = IP_PROTOCOL_TCP;
-  uint16_t total = sizeof(struct tcp_hdr) + len;
-  pseudo.len = hton16(total);
-  uint16_t psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), 0);
+/* MSS we can send before hearing from the peer, bounded by the path MTU */
+static uint16_t tcp_pcb_path_mss(struct tcp_pcb *pcb) {
+  uint16_t mtu;
 
-  uint8_t buf[IP_PAYLOAD_SIZE_MAX] = {};
-  struct tcp_hdr *hdr = (struct tcp_hdr *)buf;
-  hdr->src = local->port;
-  hdr->dst = foreign->port;
-  hdr->seq = hton32(seq);
-  hdr->ack = hton32(ack);
-  hdr->off = (sizeof(*hdr) >> 2) << 4;
-  hdr->flg = flg;
-  hdr->wnd = hton16(wnd);
-  hdr->sum = 0;
-  hdr->up = 0;
-  memcpy(hdr + 1, data, len);
-  hdr->sum = cksum16((uint16_t *)hdr, total, psum);
+  mtu = ip_route_get_mtu(pcb->foreign.addr);
+  if (mtu <= IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr)) {
+    return TCP_DEFAULT_MSS;
+  }
+  return mtu - (IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr));
+}
 
-  char ep1[IP_ENDPOINT_STR_LEN];
-  char ep2[IP_ENDPOINT_STR_LEN];
-  debugf("%s => %s, len=%zu (payload=%zu)", ip_endpoint_ntop(local, ep1, sizeof(ep1)),
-         ip_endpoint_ntop(foreign, ep2, sizeof(ep2)), total, len);
-  tcp_dump((uint8_t *)hdr, total);
+/* MSS we can receive, advertised by the MSS option */
+static uint16_t tcp_pcb_local_mss(struct tcp_pcb *pcb) {
+  struct ip_iface *iface;
 
-  if (ip_output(IP_PROTOCOL_TCP, buf, total, local->addr, foreign->addr) == -1) {
-    errorf("ip_output() failure");
-    return -1;
+  iface = ip_route_get_iface(pcb->foreign.addr);
+  if (!iface) {
+    return TCP_DEFAULT_MSS;
   }
+  return NET_IFACE(iface)->dev->mtu - (IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr));
+}
 
-  return len;
+static void tcp_hdr_template_init(struct tcp_hdr_template *tmpl, struct ip_endpoint *local,
+                                  struct ip_endpoint *foreign) {
+  struct ip_iface *iface;
+  ip_addr_t src;
+
+  src = local->addr;
+  if (src == IP_ADDR_ANY) {
+    iface = ip_route_get_iface(foreign->addr);
+    if (iface) {
+      src = iface->unicast;
+    }
+  }
+  ip_hdr_template_init(&tmpl->ip, IP_PROTOCOL_TCP, src, foreign->addr);
+  ip_hdr_template_set_df(&tmpl->ip);
+  memset(&tmpl->tcp, 0, sizeof(tmpl->tcp));
+  tmpl->tcp.src = local->port;
+  tmpl->tcp.dst = foreign->port;
+}
+
+/* NOTE: called once the foreign address is known */
+static void tcp_pcb_init_cc(struct tcp_pcb *pcb) {
+  pcb->mss = tcp_pcb_path_mss(pcb);
+  pcb->rto = TCP_DEFAULT_RTO;
+  tcp_cc_init(&pcb->cc, cc_default, pcb->mss);
+  tcp_metrics_seed(pcb);
+}
+
+/* NOTE: called with the MSS option of the SYN from the peer */
+static void tcp_pcb_set_peer_mss(struct tcp_pcb *pcb, uint16_t mss) {
+  if (!mss || mss >= pcb->mss) {
+    return;
+  }
+  pcb->mss = mss;
+  pcb->cc.mss = mss;
+}
+
+/* NOTE: called when the path MTU may have been lowered, returns 1 if the MSS has been lowered */
+static int tcp_pcb_set_path_mtu(struct tcp_pcb *pcb, uint16_t mtu) {
+  uint16_t mss;
+
+  if (mtu <= IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr)) {
+    return 0;
+  }
+  mss = pcb->mss;
+  tcp_pcb_set_peer_mss(pcb, mtu - (IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr)));
+  if (pcb->mss == mss) {
+    return 0;
+  }
+  gettimeofday(&pcb->mss_lowered, NULL);
+  stats.pmtu_shrinks++;
+  return 1;
 }
 
 /*
- * TCP Retransmit
+ * TCP Receive Buffer
  *
- * NOTE: TCP Retransmit functions must be called after mutex locked
+ * NOTE: TCP Receive Buffer functions must be called after mutex locked
  */
 
-static int tcp_retransmit_queue_add(struct tcp_pcb *pcb, uint32_t seq, uint8_t flg, uint8_t *data, size_t len) {
-  struct tcp_queue_entry *entry;
+static int tcp_rcvbuf_resize(struct tcp_pcb *pcb, size_t size) {
+  uint8_t *data;
+  size_t used, n;
 
-  entry = memory_alloc(sizeof(*entry) + len);
-  if (!entry) {
+  used = pcb->rcvbuf.size - pcb->rcv.wnd;
+  if (size < used) {
+    return -1;
+  }
+  if (size > TCP_RCVBUF_INIT && size > pcb->rcvbuf.size &&
+      rcvbuf_total + (size - pcb->rcvbuf.size) > TCP_RCVBUF_BUDGET) {
+    /* NOTE: the initial size is always granted, the budget only limits growth */
+    debugf("over budget, total=%zu, size=%zu", rcvbuf_total, size);
+    return -1;
+  }
+  data = memory_alloc(size);
+  if (!data) {
     errorf("memory_alloc() failure");
     return -1;
   }
-  entry->rto = TCP_DEFAULT_RTO;
-  entry->seq = seq;
-  entry->flg = flg;
-  entry->len = len;
-  memcpy(entry->data, data, entry->len);
-  gettimeofday(&entry->first, NULL);
-  entry->last = entry->first;
-  if (!queue_push(&pcb->queue, entry)) {
-    errorf("queue_push() failure");
-    memory_free(entry);
+  if (used) {
+    n = MIN(used, pcb->rcvbuf.size - pcb->rcvbuf.head);
+    memcpy(data, pcb->rcvbuf.data + pcb->rcvbuf.head, n);
+    memcpy(data + n, pcb->rcvbuf.data, used - n);
+  }
+  memory_free(pcb->rcvbuf.data);
+  rcvbuf_total = rcvbuf_total - pcb->rcvbuf.size + size;
+  pcb->rcvbuf.data = data;
+  pcb->rcvbuf.size = size;
+  pcb->rcvbuf.head = 0;
+  pcb->rcv.wnd = size - used;
+  return 0;
+}
+
+static int tcp_rcvbuf_init(struct tcp_pcb *pcb) {
+  if (tcp_rcvbuf_resize(pcb, TCP_RCVBUF_INIT) == -1) {
     return -1;
   }
+  gettimeofday(&pcb->rcvbuf.stamp, NULL);
+  pcb->rcvbuf.last = pcb->rcvbuf.stamp;
   return 0;
 }
 
-static void tcp_retransmit_queue_cleanup(struct tcp_pcb *pcb) {
-  struct tcp_queue_entry *entry;
+/*
+ * Direct delivery: a reader blocked in tcp_receive() on the empty buffer lends its own buffer, the data arriving in
+ * order is copied straight into it, saving the copy out of the receive buffer.
+ *
+ * NOTE: only while the receive buffer is empty, the data must not overtake what is already in there
+ */
+static size_t tcp_rcvbuf_direct_room(struct tcp_pcb *pcb) {
+  if (!pcb->reader.buf || pcb->rcv.wnd != pcb->rcvbuf.size) {
+    return 0;
+  }
+  return pcb->reader.size - pcb->reader.len;
+}
 
-  while (1) {
-    entry = queue_peek(&pcb->queue);
-    if (!entry) {
-      break;
+/* NOTE: the room is the same as when the data was copied, the state does not change while the mutex is held */
+static void tcp_rcvbuf_commit(struct tcp_pcb *pcb, size_t len) {
+  size_t direct;
+
+  direct = MIN(len, tcp_rcvbuf_direct_room(pcb));
+  if (direct) {
+    pcb->reader.len += direct;
+    stats.direct_copies++;
+  }
+  pcb->rcv.wnd -= len - direct;
+  gettimeofday(&pcb->rcvbuf.last, NULL);
+}
+
+static size_t tcp_rcvbuf_write(struct tcp_pcb *pcb, const uint8_t *data, size_t len) {
+  size_t direct, tail, n;
+
+  direct = MIN(len, tcp_rcvbuf_direct_room(pcb));
+  if (direct) {
+    memcpy(pcb->reader.buf + pcb->reader.len, data, direct);
+  }
+  len = direct + MIN(len - direct, pcb->rcv.wnd);
+  tail = (pcb->rcvbuf.head + (pcb->rcvbuf.size - pcb->rcv.wnd)) % pcb->rcvbuf.size;
+  n = MIN(len - direct, pcb->rcvbuf.size - tail);
+  memcpy(pcb->rcvbuf.data + tail, data + direct, n);
+  memcpy(pcb->rcvbuf.data, data + direct + n, len - direct - n);
+  tcp_rcvbuf_commit(pcb, len);
+  return len;
+}
+
+/* partial sum of the bytes starting at offset of the segment */
+static uint32_t tcp_cksum_at(uint32_t sum, size_t offset) {
+  if (offset % 2) {
+    sum = ((sum & 0xff) << 8) | (sum >> 8);
+  }
+  return sum;
+}
+
+/*
+ * Copies data into the free space and returns its partial sum, the data is not received until tcp_rcvbuf_commit()
+ *
+ * NOTE: len must not exceed rcv.wnd and the room lent by the reader
+ */
+static uint32_t tcp_rcvbuf_copy_csum(struct tcp_pcb *pcb, const uint8_t *data, size_t len) {
+  size_t direct, tail, n;
+  uint32_t sum = 0;
+
+  direct = MIN(len, tcp_rcvbuf_direct_room(pcb));
+  if (direct) {
+    sum = cksum16_copy(pcb->reader.buf + pcb->reader.len, data, direct, 0);
+  }
+  tail = (pcb->rcvbuf.head + (pcb->rcvbuf.size - pcb->rcv.wnd)) % pcb->rcvbuf.size;
+  n = MIN(len - direct, pcb->rcvbuf.size - tail);
+  sum += tcp_cksum_at(cksum16_copy(pcb->rcvbuf.data + tail, data + direct, n, 0), direct);
+  sum += tcp_cksum_at(cksum16_copy(pcb->rcvbuf.data, data + direct + n, len - direct - n, 0), direct + n);
+  return sum;
+}
+
+static size_t tcp_rcvbuf_read(struct tcp_pcb *pcb, uint8_t *buf, size_t size) {
+  size_t len, n;
+
+  len = MIN(size, pcb->rcvbuf.size - pcb->rcv.wnd);
+  n = MIN(len, pcb->rcvbuf.size - pcb->rcvbuf.head);
+  memcpy(buf, pcb->rcvbuf.data + pcb->rcvbuf.head, n);
+  memcpy(buf + n, pcb->rcvbuf.data, len - n);
+  pcb->rcvbuf.head = (pcb->rcvbuf.head + len) % pcb->rcvbuf.size;
+  pcb->rcv.wnd += len;
+  return len;
+}
+
+/*
+ * A receiver does not see its own segments acknowledged, the time to receive one window of data is taken as the RTT
+ * instead (see https://tools.ietf.org/html/rfc7323#section-4.2 for the timestamp based alternative).
+ */
+static void tcp_rcvbuf_rtt_update(struct tcp_pcb *pcb) {
+  struct timeval now, diff;
+  uint32_t rtt;
+
+  gettimeofday(&now, NULL);
+  if (timerisset(&pcb->rcvbuf.rtt_stamp)) {
+    if (TCP_SEQ_LT(pcb->rcv.nxt, pcb->rcvbuf.rtt_seq)) {
+      return;
     }
-    if (entry->seq >= pcb->snd.una) {
-      break;
+    timersub(&now, &pcb->rcvbuf.rtt_stamp, &diff);
+    rtt = MAX(diff.tv_sec * 1000000 + diff.tv_usec, 1);
+    if (!pcb->rcvbuf.rtt || rtt < pcb->rcvbuf.rtt) {
+      pcb->rcvbuf.rtt = rtt;
     }
-    entry = queue_pop(&pcb->queue);
-    debugf("remove, seq=%u, flags=%s, len=%u", entry->seq, tcp_flg_ntoa(entry->flg), entry->len);
-    memory_free(entry);
   }
-  return;
+  pcb->rcvbuf.rtt_seq = pcb->rcv.nxt + pcb->rcv.wnd;
+  pcb->rcvbuf.rtt_stamp = now;
 }
 
-static void tcp_retransmit_queue_emit(void *arg, void *data) {
+/* NOTE: armed only while the buffer is larger than the initial size */
+static void tcp_rcvbuf_idle_timer_update(struct tcp_pcb *pcb) {
+  struct timeval now, expire;
+
+  gettimeofday(&now, NULL);
+  expire = pcb->rcvbuf.last;
+  expire.tv_sec += TCP_RCVBUF_IDLE;
+  if (!timercmp(&expire, &now, >)) {
+    /* idle since the last arrival, but the application has not read the data yet */
+    expire = now;
+    expire.tv_sec += TCP_RCVBUF_IDLE;
+  }
+  net_timeout_arm(&pcb->rcvbuf.idle, &expire);
+}
+
+/*
+ * Dynamic right-sizing: measure how much the application drains per RTT and grow the buffer to twice that,
+ * as the sender may double its rate in the next RTT. Returns 1 if the window has been opened.
+ */
+static int tcp_rcvbuf_adjust(struct tcp_pcb *pcb, size_t copied) {
+  struct timeval now, diff;
+  uint64_t elapsed, rtt, drain;
+  size_t size;
+
+  pcb->rcvbuf.copied += copied;
+  gettimeofday(&now, NULL);
+  timersub(&now, &pcb->rcvbuf.stamp, &diff);
+  elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+  rtt = pcb->rcvbuf.rtt ? pcb->rcvbuf.rtt : (pcb->srtt ? pcb->srtt : TCP_DEFAULT_RTO);
+  if (elapsed < rtt) {
+    return 0;
+  }
+  drain = pcb->rcvbuf.copied * rtt / elapsed;
+  pcb->rcvbuf.copied = 0;
+  pcb->rcvbuf.stamp = now;
+  if (pcb->rcvbuf.limit) {
+    /* the buffer is being released, the offered window grows within it first */
+    while (pcb->rcvbuf.limit < drain * 2 && pcb->rcvbuf.limit < pcb->rcvbuf.size) {
+      pcb->rcvbuf.limit *= 2;
+    }
+    if (pcb->rcvbuf.limit >= pcb->rcvbuf.size) {
+      pcb->rcvbuf.limit = 0; /* busy again before the buffer has been released */
+    }
+  }
+  size = pcb->rcvbuf.size;
+  while (size < drain * 2 && size < TCP_RCVBUF_MAX) {
+    size *= 2;
+  }
+  size = MIN(size, TCP_RCVBUF_MAX);
+  if (size == pcb->rcvbuf.size || tcp_rcvbuf_resize(pcb, size) == -1) {
+    return 0;
+  }
+  stats.rcvbuf_grows++;
+  debugf("grown, size=%zu, drain=%lu bytes/rtt, rtt=%lu", size, drain, rtt);
+  if (!net_timeout_pending(&pcb->rcvbuf.idle)) {
+    tcp_rcvbuf_idle_timer_update(pcb);
+  }
+  return 1;
+}
+
+/* part of the window advertised last that has not been filled yet */
+static uint32_t tcp_pcb_wnd_held(struct tcp_pcb *pcb) {
+  return TCP_SEQ_GT(pcb->rcv.adv, pcb->rcv.nxt) ? pcb->rcv.adv - pcb->rcv.nxt : 0;
+}
+
+/*
+ * NOTE: the window already offered must not be taken back (see https://tools.ietf.org/html/rfc7323#section-2.4), the
+ * buffer is kept down to its right edge and no more than the initial size is offered from then on, the rest of the
+ * memory is released on a later call once the peer has used up the old window.
+ */
+static void tcp_rcvbuf_release_idle(struct tcp_pcb *pcb) {
+  struct timeval now, diff;
+  size_t size;
+
+  if (pcb->rcvbuf.size <= TCP_RCVBUF_INIT || pcb->rcv.wnd != pcb->rcvbuf.size) {
+    return;
+  }
+  gettimeofday(&now, NULL);
+  timersub(&now, &pcb->rcvbuf.last, &diff);
+  if (diff.tv_sec < TCP_RCVBUF_IDLE) {
+    return;
+  }
+  pcb->rcvbuf.limit = TCP_RCVBUF_INIT;
+  size = MAX(TCP_RCVBUF_INIT, tcp_pcb_wnd_held(pcb));
+  if (size >= pcb->rcvbuf.size || tcp_rcvbuf_resize(pcb, size) == -1) {
+    return;
+  }
+  pcb->rcvbuf.copied = 0;
+  pcb->rcvbuf.stamp = now;
+  stats.rcvbuf_shrinks++;
+  debugf("shrunk, size=%zu", pcb->rcvbuf.size);
+}
+
+static void tcp_rcvbuf_idle_timeout(void *arg) {
   struct tcp_pcb *pcb;
-  struct tcp_queue_entry *entry;
-  struct timeval now, diff, timeout;
 
   pcb = (struct tcp_pcb *)arg;
-  entry = (struct tcp_queue_entry *)data;
+  mutex_lock(&mutex);
+  /* NOTE: the pcb may have been released or the timer armed again while waiting for the mutex */
+  if (pcb->state != TCP_PCB_STATE_FREE && !net_timeout_pending(&pcb->rcvbuf.idle)) {
+    tcp_rcvbuf_release_idle(pcb);
+    if (pcb->rcvbuf.size > TCP_RCVBUF_INIT) {
+      tcp_rcvbuf_idle_timer_update(pcb);
+    }
+  }
+  mutex_unlock(&mutex);
+}
+
+/* minimum opening of the window worth advertising, see https://tools.ietf.org/html/rfc1122#section-4.2.3.3 */
+static uint32_t tcp_pcb_sws_threshold(struct tcp_pcb *pcb) { return MIN(pcb->mss, pcb->rcvbuf.size / 2); }
+
+/* free space of the buffer that may be offered, see tcp_rcvbuf_release_idle() */
+static uint32_t tcp_pcb_rcv_wnd(struct tcp_pcb *pcb) {
+  return pcb->rcvbuf.limit ? MIN(pcb->rcv.wnd, pcb->rcvbuf.limit) : pcb->rcv.wnd;
+}
+
+/* bytes by which the right edge of the window would move if advertised now */
+static uint32_t tcp_pcb_wnd_opening(struct tcp_pcb *pcb) {
+  uint32_t wnd, held;
+
+  wnd = tcp_pcb_rcv_wnd(pcb);
+  held = tcp_pcb_wnd_held(pcb);
+  return held < wnd ? wnd - held : 0;
+}
+
+/*
+ * window to put on a segment, never scaled on SYN (see https://tools.ietf.org/html/rfc7323#section-2.2)
+ *
+ * NOTE: the right edge is held until it can move by the SWS threshold, rather than offering the space freed by each
+ * small read of the application (receiver side silly window syndrome avoidance). It never moves back, even when the
+ * buffer has been shrunk, and is rounded up to the scale as Linux does, see rfc7323 section 2.4.
+ */
+static uint16_t tcp_pcb_adv_wnd(struct tcp_pcb *pcb, uint8_t flg) {
+  uint32_t wnd, held, unit;
+
+  if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
+    wnd = MIN(pcb->rcv.wnd, 0xffff);
+    pcb->rcv.adv = pcb->rcv.nxt + wnd; /* NOTE: set again on SYN-ACK for an active open, rcv.nxt is unknown yet */
+    return wnd;
+  }
+  unit = 1 << pcb->rcv.wscale;
+  wnd = MIN(tcp_pcb_rcv_wnd(pcb) >> pcb->rcv.wscale, 0xffff) << pcb->rcv.wscale;
+  held = tcp_pcb_wnd_held(pcb);
+  if (held >= wnd || wnd - held < tcp_pcb_sws_threshold(pcb)) {
+    wnd = (held + unit - 1) & ~(unit - 1);
+  }
+  pcb->rcv.adv = pcb->rcv.nxt + wnd;
+  return wnd >> pcb->rcv.wscale;
+}
+
+/* see https://tools.ietf.org/html/rfc6298 */
+static void tcp_rtt_update(struct tcp_pcb *pcb, uint32_t rtt) {
+  uint32_t delta;
+
+  if (!pcb->srtt) {
+    pcb->srtt = rtt;
+    pcb->rttvar = rtt / 2;
+  } else {
+    delta = pcb->srtt > rtt ? pcb->srtt - rtt : rtt - pcb->srtt;
+    pcb->rttvar = (3 * pcb->rttvar + delta) / 4;
+    pcb->srtt = (7 * pcb->srtt + rtt) / 8;
+  }
+  pcb->rto = MAX(pcb->srtt + 4 * pcb->rttvar, TCP_MIN_RTO);
+}
+
+/*
+ * TCP Pacing
+ *
+ * NOTE: TCP Pacing functions must be called after mutex locked
+ */
+
+static uint64_t tcp_pacing_rate(struct tcp_pcb *pcb) {
+  uint64_t rate;
+
+  if (pcb->cc.pacing_rate) {
+    return pcb->cc.pacing_rate;
+  }
+  if (!pcb->srtt) {
+    return 0;
+  }
+  /* same ratio as Linux: 200% of cwnd/srtt in slow start, 120% otherwise */
+  rate = (uint64_t)pcb->cc.cwnd * 1000000 / pcb->srtt;
+  return pcb->cc.cwnd < pcb->cc.ssthresh ? rate * 2 : rate * 6 / 5;
+}
+
+static int tcp_pacing_delay(struct tcp_pcb *pcb, struct timespec *abstime) {
+  struct timeval now, limit;
+
   gettimeofday(&now, NULL);
-  timersub(&now, &entry->first, &diff);
-  if (diff.tv_sec >= TCP_RETRANSMIT_DEADLINE) {
-    pcb->state = TCP_PCB_STATE_CLOSED;
-    sched_wakeup(&pcb->ctx);
+  limit = now;
+  timeval_add_usec(&limit, TCP_PACING_QUANTUM);
+  if (!timercmp(&pcb->pacing, &limit, >)) {
+    return 0;
+  }
+  abstime->tv_sec = pcb->pacing.tv_sec;
+  abstime->tv_nsec = pcb->pacing.tv_usec * 1000;
+  return 1;
+}
+
+static void tcp_pacing_update(struct tcp_pcb *pcb, size_t len) {
+  struct timeval now;
+  uint64_t rate, usec;
+
+  rate = tcp_pacing_rate(pcb);
+  if (!rate) {
+    return;
+  }
+  gettimeofday(&now, NULL);
+  if (timercmp(&pcb->pacing, &now, <)) {
+    pcb->pacing = now; /* no credit for idle time */
+  }
+  usec = len * 1000000 / rate;
+  timeval_add_usec(&pcb->pacing, usec);
+}
+
+/*
+ * TCP Options
+ */
+
+static void tcp_options_parse(const struct tcp_hdr *hdr, uint16_t hlen, struct tcp_options *opt) {
+  const uint8_t *p, *end;
+  int i;
+
+  memset(opt, 0, sizeof(*opt));
+  opt->wscale = -1;
+  p = (const uint8_t *)(hdr + 1);
+  end = (const uint8_t *)hdr + hlen;
+  while (p < end) {
+    if (*p == TCP_OPT_EOL) {
+      break;
+    }
+    if (*p == TCP_OPT_NOP) {
+      p++;
+      continue;
+    }
+    if (p + 1 >= end || p[1] < 2 || p + p[1] > end) {
+      /* malformed, ignore the rest */
+      break;
+    }
+    switch (p[0]) {
+      case TCP_OPT_MSS:
+        if (p[1] == 4) {
+          opt->mss = p[2] << 8 | p[3];
+        }
+        break;
+      case TCP_OPT_WSCALE:
+        if (p[1] == 3) {
+          opt->wscale = MIN(p[2], 14); /* see https://tools.ietf.org/html/rfc7323#section-2.3 */
+        }
+        break;
+      case TCP_OPT_FASTOPEN:
+        if (p[1] == 2 || (p[1] - 2 >= TCP_FASTOPEN_COOKIE_LEN_MIN && p[1] - 2 <= TCP_FASTOPEN_COOKIE_LEN_MAX)) {
+          opt->fastopen = 1;
+          opt->cookie_len = p[1] - 2;
+          memcpy(opt->cookie, p + 2, opt->cookie_len);
+        }
+        break;
+      case TCP_OPT_SACK_PERMITTED:
+        if (p[1] == 2) {
+          opt->sack_permitted = 1;
+        }
+        break;
+      case TCP_OPT_SACK:
+        if ((p[1] - 2) % 8 == 0) {
+          opt->sack_num = MIN((p[1] - 2) / 8, TCP_SACK_BLOCKS_MAX);
+          for (i = 0; i < opt->sack_num; i++) {
+            memcpy(&opt->sack[i], p + 2 + i * 8, 8);
+            opt->sack[i].left = ntoh32(opt->sack[i].left);
+            opt->sack[i].right = ntoh32(opt->sack[i].right);
+          }
+        }
+        break;
+    }
+    p += p[1];
+  }
+}
+
+/* NOTE: must be called after mutex locked */
+static size_t tcp_options_build_syn(struct tcp_pcb *pcb, uint8_t *buf) {
+  uint16_t mss;
+  size_t len = 0;
+
+  mss = tcp_pcb_local_mss(pcb);
+  buf[len++] = TCP_OPT_MSS;
+  buf[len++] = 4;
+  buf[len++] = mss >> 8;
+  buf[len++] = mss & 0xff;
+  if (pcb->rcv.wscale) {
+    buf[len++] = TCP_OPT_NOP;
+    buf[len++] = TCP_OPT_WSCALE;
+    buf[len++] = 3;
+    buf[len++] = pcb->rcv.wscale;
+  }
+  if (pcb->fastopen.option) {
+    buf[len++] = TCP_OPT_FASTOPEN;
+    buf[len++] = 2 + pcb->fastopen.cookie_len;
+    memcpy(buf + len, pcb->fastopen.cookie, pcb->fastopen.cookie_len);
+    len += pcb->fastopen.cookie_len;
+  }
+  if (pcb->sack.permitted) {
+    buf[len++] = TCP_OPT_SACK_PERMITTED;
+    buf[len++] = 2;
+  }
+  while (len & 3) {
+    buf[len++] = TCP_OPT_NOP;
+  }
+  return len;
+}
+
+/*
+ * TCP Fast Open, see https://tools.ietf.org/html/rfc7413
+ *
+ * NOTE: TCP Fast Open functions must be called after mutex locked
+ */
+
+static void tcp_fastopen_cookie(ip_addr_t addr, uint8_t *cookie) {
+  uint64_t mac;
+
+  /* NOTE: a MAC of the client address with a secret key, the client cannot forge it for other addresses */
+  mac = siphash(fastopen_key, &addr, sizeof(addr));
+  memcpy(cookie, &mac, TCP_FASTOPEN_COOKIE_LEN);
+}
+
+static struct tcp_fastopen_cache *tcp_fastopen_cache_select(ip_addr_t addr) {
+  struct tcp_fastopen_cache *entry;
+
+  for (entry = fastopen_caches; entry < tailof(fastopen_caches); entry++) {
+    if (entry->addr && entry->addr == addr) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void tcp_fastopen_cache_delete(ip_addr_t addr) {
+  struct tcp_fastopen_cache *entry;
+  char addr1[IP_ADDR_STR_LEN];
+
+  entry = tcp_fastopen_cache_select(addr);
+  if (!entry) {
+    return;
+  }
+  debugf("DELETE: addr=%s", ip_addr_ntop(addr, addr1, sizeof(addr1)));
+  memset(entry, 0, sizeof(*entry));
+}
+
+static void tcp_fastopen_cache_update(ip_addr_t addr, const uint8_t *cookie, uint8_t len, uint16_t mss) {
+  struct tcp_fastopen_cache *entry, *oldest = NULL;
+  char addr1[IP_ADDR_STR_LEN];
+
+  entry = tcp_fastopen_cache_select(addr);
+  if (!entry) {
+    for (entry = fastopen_caches; entry < tailof(fastopen_caches); entry++) {
+      if (!entry->addr) {
+        break;
+      }
+      if (!oldest || timercmp(&oldest->timestamp, &entry->timestamp, >)) {
+        oldest = entry;
+      }
+    }
+    if (entry == tailof(fastopen_caches)) {
+      entry = oldest;
+    }
+  }
+  entry->addr = addr;
+  entry->mss = mss;
+  entry->cookie_len = len;
+  memcpy(entry->cookie, cookie, len);
+  gettimeofday(&entry->timestamp, NULL);
+  debugf("UPDATE: addr=%s, len=%u, mss=%u", ip_addr_ntop(addr, addr1, sizeof(addr1)), len, mss);
+}
+
+/* client: prepare the Fast Open option of the SYN, returns the length of data that the SYN can carry */
+static size_t tcp_fastopen_connect(struct tcp_pcb *pcb, size_t len) {
+  struct tcp_fastopen_cache *entry;
+  uint8_t opt[TCP_OPT_LEN_MAX];
+  size_t optlen;
+
+  if (!(fastopen & TCP_FASTOPEN_CLIENT)) {
+    return 0;
+  }
+  pcb->fastopen.option = 1;
+  entry = tcp_fastopen_cache_select(pcb->foreign.addr);
+  if (!entry) {
+    /* send a cookie request, the data follows the handshake */
+    stats.fastopen_cookie_reqs++;
+    return 0;
+  }
+  pcb->fastopen.cookie_len = entry->cookie_len;
+  memcpy(pcb->fastopen.cookie, entry->cookie, entry->cookie_len);
+  tcp_pcb_set_peer_mss(pcb, entry->mss);
+  /* NOTE: the options of the SYN take room from the segment, built here the same way as tcp_output_mapped() does */
+  optlen = tcp_options_build_syn(pcb, opt);
+  return MIN(len, pcb->mss - optlen);
+}
+
+/* server: validate the cookie of the SYN and accept its data, returns the length of data accepted */
+static size_t tcp_fastopen_accept(struct tcp_pcb *pcb, struct tcp_options *opt, uint8_t *data, size_t len) {
+  uint8_t cookie[TCP_FASTOPEN_COOKIE_LEN];
+
+  if (!(fastopen & TCP_FASTOPEN_SERVER) || !opt->fastopen) {
+    return 0;
+  }
+  tcp_fastopen_cookie(pcb->foreign.addr, cookie);
+  if (opt->cookie_len != sizeof(cookie) || memcmp(opt->cookie, cookie, sizeof(cookie)) != 0) {
+    /* cookie request or invalid cookie, give a valid one back with SYN-ACK */
+    pcb->fastopen.option = 1;
+    pcb->fastopen.cookie_len = sizeof(cookie);
+    memcpy(pcb->fastopen.cookie, cookie, sizeof(cookie));
+    return 0;
+  }
+  len = MIN(len, pcb->rcv.wnd);
+  if (!len) {
+    return 0;
+  }
+  tcp_rcvbuf_write(pcb, data, len);
+  pcb->fastopen.accepted = 1;
+  stats.fastopen_passive++;
+  return len;
+}
+
+/* NOTE: called for each frame of a segment split by ip_output_gso() */
+static void tcp_gso_fixup(uint8_t *seg, size_t len, size_t offset, int last, uint32_t sum) {
+  struct tcp_hdr *hdr;
+
+  (void)len;
+  hdr = (struct tcp_hdr *)seg;
+  hdr->seq = hton32(ntoh32(hdr->seq) + offset);
+  if (!last) {
+    hdr->flg &= ~(TCP_FLG_FIN | TCP_FLG_PSH);
+  }
+  hdr->sum = 0;
+  hdr->sum = cksum16((uint16_t *)hdr, (hdr->off >> 4) << 2, sum);
+}
+
+/* NOTE: a segment refused for exceeding a path MTU just learned is split again into frames of the lowered MSS */
+static int tcp_output_ip(struct tcp_pcb *pcb, struct ip_dst_cache *dst, const struct ip_hdr_template *tmpl,
+                         uint8_t *hdr, uint8_t *data, size_t len, const struct ip_gso *gso) {
+  struct ip_gso retry = {.hlen = gso->hlen, .fixup = tcp_gso_fixup};
+
+  if (ip_output_dst_sg(dst, tmpl, hdr, data, len, gso) != -1) {
+    return 0;
+  }
+  if (!pcb) {
+    return -1;
+  }
+  tcp_pcb_set_path_mtu(pcb, dst->mtu);
+  if (len <= pcb->mss || gso->size <= pcb->mss) {
+    return -1;
+  }
+  retry.size = pcb->mss;
+  return ip_output_dst_sg(dst, tmpl, hdr, data, len, &retry) == -1 ? -1 : 0;
+}
+
+/*
+ * NOTE: a segment longer than gso_size is split into frames of gso_size bytes by the IP layer (0 to never split),
+ * pcb is NULL for a segment out of any connection (RST), whose headers are built from the endpoints. Only the header
+ * is built here, the IP layer copies data straight into the frames and the checksum is completed by tcp_gso_fixup().
+ */
+static ssize_t tcp_output_segment(uint32_t seq, uint32_t ack, uint8_t flg, uint16_t wnd, uint8_t *opt, size_t optlen,
+                                  uint8_t *data, size_t len, uint16_t gso_size, struct ip_endpoint *local,
+                                  struct ip_endpoint *foreign, struct tcp_pcb *pcb) {
+  struct tcp_hdr_template tmp;
+  const struct tcp_hdr_template *tmpl = &tmp;
+  struct ip_dst_cache dst = {};
+  if (pcb) {
+    tmpl = &pcb->tmpl;
+  } else {
+    tcp_hdr_template_init(&tmp, local, foreign);
+  }
+  uint16_t total = sizeof(struct tcp_hdr) + optlen + len;
+
+  char ep1[IP_ENDPOINT_STR_LEN];
+  char ep2[IP_ENDPOINT_STR_LEN];
+  uint8_t buf[sizeof(struct tcp_hdr) + TCP_OPT_LEN_MAX];
+  struct tcp_hdr *hdr = (struct tcp_hdr *)buf;
+  *hdr = tmpl->tcp;
+  hdr->seq = hton32(seq);
+  hdr->ack = hton32(ack);
+  hdr->off = ((sizeof(*hdr) + optlen) >> 2) << 4;
+  hdr->flg = flg;
+  hdr->wnd = hton16(wnd);
+  memcpy(hdr + 1, opt, optlen);
+
+  struct ip_gso gso = {len, sizeof(*hdr) + optlen, tcp_gso_fixup}; /* NOTE: one frame unless split below */
+  if (gso_size && len > gso_size) {
+    gso.size = gso_size;
+    debugf("%s => %s, len=%zu (payload=%zu), gso_size=%u", ip_endpoint_ntop(local, ep1, sizeof(ep1)),
+           ip_endpoint_ntop(foreign, ep2, sizeof(ep2)), total, len, gso_size);
+    stats.segs_out += (len + gso_size - 1) / gso_size;
+    stats.gso_batches++;
+  } else {
+    debugf("%s => %s, len=%zu (payload=%zu)", ip_endpoint_ntop(local, ep1, sizeof(ep1)),
+           ip_endpoint_ntop(foreign, ep2, sizeof(ep2)), total, len);
+    tcp_dump((uint8_t *)hdr, sizeof(*hdr) + optlen); /* NOTE: the checksum is not filled in yet */
+    stats.segs_out++;
+  }
+  if (tcp_output_ip(pcb, pcb ? &pcb->dst : &dst, &tmpl->ip, buf, data, len, &gso) == -1) {
+    errorf("tcp_output_ip() failure");
+    return -1;
+  }
+
+  return len;
+}
+
+/*
+ * TCP File Mapping
+ *
+ * NOTE: TCP File Mapping functions must be called after mutex locked
+ */
+
+static struct tcp_mapping *tcp_mapping_create(int fd, off_t offset, size_t len, uint8_t **data) {
+  struct tcp_mapping *map;
+  off_t base;
+
+  map = memory_alloc(sizeof(*map));
+  if (!map) {
+    errorf("memory_alloc() failure");
+    return NULL;
+  }
+  base = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1); /* mmap() requires page aligned offset */
+  map->len = len + (offset - base);
+  map->addr = mmap(NULL, map->len, PROT_READ, MAP_SHARED, fd, base);
+  if (map->addr == MAP_FAILED) {
+    errorf("mmap: %s", strerror(errno));
+    memory_free(map);
+    return NULL;
+  }
+  map->ref = 1;
+  *data = (uint8_t *)map->addr + (offset - base);
+  return map;
+}
+
+/* NOTE: the buffer of tcp_send_zc() is shared the same way, without a copy into the retransmit entries */
+static struct tcp_mapping *tcp_mapping_lend(struct tcp_pcb *pcb, uint8_t *data, size_t len, uint64_t cookie) {
+  struct tcp_mapping *map;
+
+  map = memory_alloc(sizeof(*map));
+  if (!map) {
+    errorf("memory_alloc() failure");
+    return NULL;
+  }
+  map->addr = data;
+  map->len = len;
+  map->lent = 1;
+  map->cookie = cookie;
+  if (!queue_push(&pcb->zc, map)) {
+    errorf("queue_push() failure");
+    memory_free(map);
+    return NULL;
+  }
+  map->ref = 1;
+  return map;
+}
+
+static void tcp_mapping_put(struct tcp_mapping *map) {
+  if (--map->ref) {
+    return;
+  }
+  if (map->lent) {
+    /* NOTE: acknowledged (or discarded), left on pcb->zc until reaped */
+    stats.zc_completions++;
+    return;
+  }
+  munmap(map->addr, map->len);
+  memory_free(map);
+}
+
+/* NOTE: completions come in the order sent, as the retransmit entries are acknowledged in sequence order */
+static size_t tcp_mapping_reap(struct tcp_pcb *pcb, uint64_t *cookies, size_t n) {
+  struct tcp_mapping *map;
+  size_t count = 0;
+
+  while (count < n && (map = queue_peek(&pcb->zc)) != NULL && !map->ref) {
+    queue_pop(&pcb->zc);
+    cookies[count++] = map->cookie;
+    memory_free(map);
+  }
+  return count;
+}
+
+/*
+ * TCP Loss Detection (RACK-TLP), see https://tools.ietf.org/html/rfc8985
+ *
+ * NOTE: TCP Loss Detection functions must be called after mutex locked
+ */
+
+struct tcp_rack_walk {
+  struct tcp_pcb *pcb;
+  struct timeval now;
+  struct tcp_sack_block block; /* newly delivered range */
+  long timeout;                /* micro seconds until the next segment outlives the reordering window */
+  int lost;
+};
+
+static long tcp_usec_between(const struct timeval *from, const struct timeval *to) {
+  struct timeval diff;
+
+  timersub(to, from, &diff);
+  return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static void tcp_sack_update(struct tcp_pcb *pcb, uint32_t left, uint32_t right) {
+  struct tcp_sack_block *b = pcb->sack.blocks;
+  int i;
+
+  /* merge the overlapping and adjacent blocks */
+  for (i = 0; i < pcb->sack.num;) {
+    if (TCP_SEQ_LT(b[i].right, left) || TCP_SEQ_LT(right, b[i].left)) {
+      i++;
+      continue;
+    }
+    left = TCP_SEQ_MIN(left, b[i].left);
+    right = TCP_SEQ_MAX(right, b[i].right);
+    memmove(&b[i], &b[i + 1], (pcb->sack.num - i - 1) * sizeof(*b));
+    pcb->sack.num--;
+  }
+  for (i = 0; i < pcb->sack.num && TCP_SEQ_LT(b[i].left, left); i++)
+    ;
+  if (i == TCP_SACK_SCOREBOARD) {
+    return; /* NOTE: the highest blocks are forgotten when full, at worst they are retransmitted */
+  }
+  memmove(&b[i + 1], &b[i], (MIN(pcb->sack.num, TCP_SACK_SCOREBOARD - 1) - i) * sizeof(*b));
+  b[i].left = left;
+  b[i].right = right;
+  pcb->sack.num = MIN(pcb->sack.num + 1, TCP_SACK_SCOREBOARD);
+}
+
+static void tcp_sack_prune(struct tcp_pcb *pcb) {
+  struct tcp_sack_block *b = pcb->sack.blocks;
+
+  while (pcb->sack.num && TCP_SEQ_LEQ(b[0].right, pcb->snd.una)) {
+    memmove(&b[0], &b[1], (pcb->sack.num - 1) * sizeof(*b));
+    pcb->sack.num--;
+  }
+  if (pcb->sack.num && TCP_SEQ_LT(b[0].left, pcb->snd.una)) {
+    b[0].left = pcb->snd.una;
+  }
+}
+
+/* returns the first range in [*left, right) not covered by the scoreboard, 0 if none */
+static int tcp_sack_next_hole(struct tcp_pcb *pcb, uint32_t *left, uint32_t *right) {
+  struct tcp_sack_block *b = pcb->sack.blocks;
+  int i;
+
+  for (i = 0; i < pcb->sack.num && TCP_SEQ_LT(*left, *right); i++) {
+    if (TCP_SEQ_LEQ(b[i].right, *left)) {
+      continue;
+    }
+    if (TCP_SEQ_GT(b[i].left, *left)) {
+      *right = TCP_SEQ_MIN(*right, b[i].left);
+      break;
+    }
+    *left = b[i].right;
+  }
+  return TCP_SEQ_LT(*left, *right);
+}
+
+static uint32_t tcp_queue_entry_end(struct tcp_queue_entry *entry) {
+  return entry->seq + entry->len + TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN) + TCP_FLG_ISSET(entry->flg, TCP_FLG_FIN);
+}
+
+/* NOTE: called for each segment newly delivered, either cumulatively acknowledged or selectively acknowledged */
+static void tcp_rack_update(struct tcp_pcb *pcb, struct tcp_queue_entry *entry, uint32_t end_seq,
+                            const struct timeval *now) {
+  uint32_t rtt;
+
+  rtt = MAX(tcp_usec_between(&entry->last, now), 1);
+  if (entry->retransmits && rtt < pcb->rack.min_rtt) {
+    return; /* the ACK is likely for the original transmission */
+  }
+  if (!entry->retransmits && (!pcb->rack.min_rtt || rtt < pcb->rack.min_rtt)) {
+    pcb->rack.min_rtt = rtt;
+  }
+  if (timercmp(&entry->last, &pcb->rack.xmit, >) ||
+      (timercmp(&entry->last, &pcb->rack.xmit, ==) && TCP_SEQ_GT(end_seq, pcb->rack.end_seq))) {
+    pcb->rack.xmit = entry->last;
+    pcb->rack.end_seq = end_seq;
+    pcb->rack.rtt = rtt;
+  }
+}
+
+static void tcp_rack_mark_sacked(void *arg, void *data) {
+  struct tcp_rack_walk *walk = arg;
+  struct tcp_queue_entry *entry = data;
+
+  if (TCP_SEQ_LT(entry->seq, walk->block.right) && TCP_SEQ_LT(walk->block.left, tcp_queue_entry_end(entry))) {
+    tcp_rack_update(walk->pcb, entry, TCP_SEQ_MIN(tcp_queue_entry_end(entry), walk->block.right), &walk->now);
+  }
+}
+
+/* reduces the congestion window once per round trip, for losses detected without a retransmission timeout */
+static void tcp_rack_enter_recovery(struct tcp_pcb *pcb) {
+  if (pcb->rack.recovering) {
+    return;
+  }
+  pcb->rack.recovering = 1;
+  pcb->rack.recovery_end = pcb->snd.nxt;
+  if (pcb->cc.ops && pcb->cc.ops->recovery) {
+    pcb->cc.ops->recovery(&pcb->cc, pcb->snd.nxt - pcb->snd.una);
+  }
+}
+
+/* NOTE: only the ranges not selectively acknowledged are sent again */
+static void tcp_rack_retransmit(struct tcp_pcb *pcb, struct tcp_queue_entry *entry, const struct timeval *now) {
+  uint32_t left, right, end;
+  uint8_t flg;
+  size_t len;
+
+  end = tcp_queue_entry_end(entry);
+  if (timercmp(&entry->last, &pcb->rack.xmit, ==)) {
+    end = TCP_SEQ_MIN(end, pcb->rack.end_seq); /* the rest of the batch has not been outlived by a delivered segment */
+  }
+  for (left = entry->seq, right = end; tcp_sack_next_hole(pcb, &left, &right); left = right, right = end) {
+    len = TCP_SEQ_MIN(right, entry->seq + entry->len) - left;
+    flg = entry->flg & ~TCP_FLG_FIN;
+    if (right == end) {
+      flg = entry->flg;
+    }
+    tcp_output_segment(left, pcb->rcv.nxt, flg, tcp_pcb_adv_wnd(pcb, flg), NULL, 0, entry->data + (left - entry->seq),
+                       len, pcb->mss, &pcb->local, &pcb->foreign, pcb);
+    stats.retransmits++;
+    stats.rack_retransmits++;
+  }
+  entry->retransmits++;
+  entry->last = *now;
+}
+
+static void tcp_rack_detect_entry(void *arg, void *data) {
+  struct tcp_rack_walk *walk = arg;
+  struct tcp_queue_entry *entry = data;
+  struct tcp_pcb *pcb = walk->pcb;
+  uint32_t left, right, reo_wnd;
+  long remaining;
+
+  if (TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN)) {
+    return; /* left to the retransmission timeout */
+  }
+  if (timercmp(&entry->last, &pcb->rack.xmit, >) ||
+      (timercmp(&entry->last, &pcb->rack.xmit, ==) && TCP_SEQ_GEQ(entry->seq, pcb->rack.end_seq))) {
+    return; /* sent after the most recently delivered segment */
+  }
+  left = entry->seq;
+  right = tcp_queue_entry_end(entry);
+  if (!tcp_sack_next_hole(pcb, &left, &right)) {
+    return; /* delivered */
+  }
+  reo_wnd = MIN(pcb->rack.min_rtt / 4, pcb->srtt);
+  remaining = pcb->rack.rtt + reo_wnd - tcp_usec_between(&entry->last, &walk->now);
+  if (remaining > 0) {
+    walk->timeout = MAX(walk->timeout, remaining);
+    return;
+  }
+  tcp_rack_retransmit(pcb, entry, &walk->now);
+  walk->lost++;
+}
+
+/* a segment is deemed lost once a segment sent later has been delivered and the reordering window has passed */
+static void tcp_rack_detect_loss(struct tcp_pcb *pcb, const struct timeval *now) {
+  struct tcp_rack_walk walk = {.pcb = pcb, .now = *now};
+  struct timeval expire;
+
+  queue_foreach(&pcb->queue, tcp_rack_detect_entry, &walk);
+  if (walk.lost) {
+    tcp_rack_enter_recovery(pcb);
+  }
+  if (!walk.timeout) {
+    net_timeout_cancel(&pcb->rack.reorder);
+    return;
+  }
+  expire = *now;
+  timeval_add_usec(&expire, walk.timeout);
+  net_timeout_arm(&pcb->rack.reorder, &expire);
+}
+
+static void tcp_rack_reorder_timeout(void *arg) {
+  struct tcp_pcb *pcb;
+  struct timeval now;
+
+  pcb = (struct tcp_pcb *)arg;
+  mutex_lock(&mutex);
+  /* NOTE: the pcb may have been released or the timer armed again while waiting for the mutex */
+  if (pcb->state != TCP_PCB_STATE_FREE && !net_timeout_pending(&pcb->rack.reorder)) {
+    gettimeofday(&now, NULL);
+    tcp_rack_detect_loss(pcb, &now);
+  }
+  mutex_unlock(&mutex);
+}
+
+static void tcp_rack_find_tail(void *arg, void *data) { *(struct tcp_queue_entry **)arg = data; }
+
+/*
+ * arms the probe timeout (PTO) of the segments in flight, unless the retransmission timeout comes first
+ *
+ * NOTE: called when new data is sent and when an ACK arrives
+ */
+static void tcp_tlp_timer_update(struct tcp_pcb *pcb) {
+  struct tcp_queue_entry *head;
+  struct timeval expire, rto;
+  uint32_t pto;
+
+  head = queue_peek(&pcb->queue);
+  if (!head || !pcb->srtt || pcb->rack.tlp_out || pcb->rack.recovering || TCP_FLG_ISSET(head->flg, TCP_FLG_SYN)) {
+    net_timeout_cancel(&pcb->rack.tlp);
+    return;
+  }
+  pto = 2 * pcb->srtt;
+  if (pcb->snd.nxt - pcb->snd.una <= pcb->mss) {
+    pto += TCP_TLP_DELACK; /* a single segment may be acknowledged late by the delayed ACK */
+  }
+  gettimeofday(&expire, NULL);
+  timeval_add_usec(&expire, pto);
+  rto = head->last;
+  timeval_add_usec(&rto, head->rto);
+  if (!timercmp(&expire, &rto, <)) {
+    net_timeout_cancel(&pcb->rack.tlp);
+    return;
+  }
+  net_timeout_arm(&pcb->rack.tlp, &expire);
+}
+
+/* sends the last segment again, so that a tail loss is reported by the ACK without waiting for the RTO */
+static void tcp_tlp_timeout(void *arg) {
+  struct tcp_pcb *pcb;
+  struct tcp_queue_entry *tail = NULL;
+  uint8_t flg;
+  size_t len;
+
+  pcb = (struct tcp_pcb *)arg;
+  mutex_lock(&mutex);
+  /* NOTE: the pcb may have been released or the timer armed again while waiting for the mutex */
+  if (pcb->state == TCP_PCB_STATE_FREE || net_timeout_pending(&pcb->rack.tlp) || pcb->rack.tlp_out) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  queue_foreach(&pcb->queue, tcp_rack_find_tail, &tail);
+  if (!tail || TCP_FLG_ISSET(tail->flg, TCP_FLG_SYN)) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  len = MIN(tail->len, pcb->mss);
+  flg = tail->flg;
+  tcp_output_segment(tail->seq + tail->len - len, pcb->rcv.nxt, flg, tcp_pcb_adv_wnd(pcb, flg), NULL, 0,
+                     tail->data + tail->len - len, len, 0, &pcb->local, &pcb->foreign, pcb);
+  tail->retransmits++;
+  stats.retransmits++;
+  stats.tlp_probes++;
+  pcb->rack.tlp_out = 1;
+  pcb->rack.tlp_end = pcb->snd.nxt;
+  mutex_unlock(&mutex);
+}
+
+/* NOTE: called for an acceptable ACK after the cumulatively acknowledged segments are removed from the queue */
+static void tcp_rack_ack(struct tcp_pcb *pcb, struct tcp_segment_info *seg, uint32_t prior_una) {
+  struct tcp_rack_walk walk = {.pcb = pcb};
+  int i;
+
+  gettimeofday(&walk.now, NULL);
+  for (i = 0; pcb->sack.permitted && i < seg->opt.sack_num; i++) {
+    walk.block = seg->opt.sack[i];
+    if (TCP_SEQ_LEQ(walk.block.right, pcb->snd.una) || TCP_SEQ_GEQ(walk.block.left, walk.block.right) ||
+        TCP_SEQ_GT(walk.block.right, pcb->snd.nxt)) {
+      continue; /* old, reversed or beyond what was sent */
+    }
+    walk.block.left = TCP_SEQ_MAX(walk.block.left, pcb->snd.una);
+    tcp_sack_update(pcb, walk.block.left, walk.block.right);
+    queue_foreach(&pcb->queue, tcp_rack_mark_sacked, &walk);
+  }
+  tcp_sack_prune(pcb);
+  if (pcb->rack.tlp_out && TCP_SEQ_GEQ(seg->ack, pcb->rack.tlp_end)) {
+    if (TCP_SEQ_GT(seg->ack, pcb->rack.tlp_end)) {
+      /* NOTE: without DSACK, an ACK beyond the probe means it has repaired a loss */
+      pcb->rack.tlp_out = 0;
+      tcp_rack_enter_recovery(pcb);
+    } else if (pcb->snd.una == prior_una && !seg->opt.sack_num) {
+      pcb->rack.tlp_out = 0; /* a duplicate ACK: both the original and the probe have arrived */
+    }
+  }
+  if (pcb->rack.recovering && TCP_SEQ_GEQ(pcb->snd.una, pcb->rack.recovery_end)) {
+    pcb->rack.recovering = 0;
+  }
+  if (pcb->sack.num) {
+    tcp_rack_detect_loss(pcb, &walk.now);
+  }
+  tcp_tlp_timer_update(pcb);
+}
+
+/*
+ * TCP Retransmit
+ *
+ * NOTE: TCP Retransmit functions must be called after mutex locked
+ */
+
+/* arms the timer for the oldest entry, its retransmission timeout or the deadline whichever comes first */
+static void tcp_retransmit_timer_update(struct tcp_pcb *pcb) {
+  struct tcp_queue_entry *entry;
+  struct timeval expire, deadline;
+
+  entry = queue_peek(&pcb->queue);
+  if (!entry) {
+    net_timeout_cancel(&pcb->retransmit);
+    return;
+  }
+  expire = entry->last;
+  timeval_add_usec(&expire, entry->rto);
+  deadline = entry->first;
+  deadline.tv_sec += TCP_RETRANSMIT_DEADLINE;
+  net_timeout_arm(&pcb->retransmit, timercmp(&deadline, &expire, <) ? &deadline : &expire);
+}
+
+static int tcp_retransmit_queue_add(struct tcp_pcb *pcb, uint32_t seq, uint8_t flg, uint8_t *data, size_t len,
+                                    struct tcp_mapping *map) {
+  struct tcp_queue_entry *entry;
+
+  entry = memory_alloc(sizeof(*entry) + (map ? 0 : len));
+  if (!entry) {
+    errorf("memory_alloc() failure");
+    return -1;
+  }
+  entry->rto = pcb->rto;
+  entry->seq = seq;
+  entry->flg = flg;
+  entry->len = len;
+  if (map) {
+    /* refer to the mapped pages instead of copying them */
+    entry->data = data;
+    entry->map = map;
+    map->ref++;
+  } else {
+    entry->data = entry->buf;
+    memcpy(entry->buf, data, entry->len);
+  }
+  gettimeofday(&entry->first, NULL);
+  entry->last = entry->first;
+  if (pcb->snd.nxt == pcb->snd.una) {
+    pcb->delivered_time = entry->first; /* start of a new flight */
+  }
+  entry->delivered = pcb->delivered;
+  entry->delivered_time = pcb->delivered_time;
+  if (!queue_push(&pcb->queue, entry)) {
+    errorf("queue_push() failure");
+    if (entry->map) {
+      tcp_mapping_put(entry->map);
+    }
+    memory_free(entry);
+    return -1;
+  }
+  if (entry == queue_peek(&pcb->queue)) {
+    tcp_retransmit_timer_update(pcb);
+  }
+  return 0;
+}
+
+static void tcp_retransmit_queue_entry_free(struct tcp_queue_entry *entry) {
+  if (entry->map) {
+    tcp_mapping_put(entry->map);
+  }
+  memory_free(entry);
+}
+
+static void tcp_retransmit_queue_cleanup(struct tcp_pcb *pcb) {
+  struct tcp_queue_entry *entry;
+  struct tcp_cc_sample rs = {};
+  struct timeval now, diff, prior_time;
+  uint32_t rtt = 0;
+
+  gettimeofday(&now, NULL);
+  while (1) {
+    entry = queue_peek(&pcb->queue);
+    if (!entry) {
+      break;
+    }
+    if (entry->seq >= pcb->snd.una) {
+      break;
+    }
+    if (!entry->retransmits) {
+      /* Karn's algorithm: never take samples from retransmitted segments */
+      timersub(&now, &entry->first, &diff);
+      rtt = MAX(diff.tv_sec * 1000000 + diff.tv_usec, 1);
+    }
+    tcp_rack_update(pcb, entry, TCP_SEQ_MIN(tcp_queue_entry_end(entry), pcb->snd.una), &now);
+    if (!TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN) &&
+        TCP_SEQ_GT(entry->seq + entry->len + TCP_FLG_ISSET(entry->flg, TCP_FLG_FIN), pcb->snd.una)) {
+      /* NOTE: a segment split by GSO is acknowledged frame by frame, keep the rest for retransmission */
+      rs.acked += pcb->snd.una - entry->seq;
+      entry->data += pcb->snd.una - entry->seq;
+      entry->len -= pcb->snd.una - entry->seq;
+      entry->seq = pcb->snd.una;
+      rs.prior_delivered = entry->delivered;
+      prior_time = entry->delivered_time;
+      break;
+    }
+    entry = queue_pop(&pcb->queue);
+    debugf("remove, seq=%u, flags=%s, len=%u", entry->seq, tcp_flg_ntoa(entry->flg), entry->len);
+    /* NOTE: a SYN carrying data may be acknowledged only for the SYN */
+    rs.acked += MIN(entry->len + TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN) + TCP_FLG_ISSET(entry->flg, TCP_FLG_FIN),
+                    pcb->snd.una - entry->seq);
+    rs.prior_delivered = entry->delivered;
+    prior_time = entry->delivered_time;
+    tcp_retransmit_queue_entry_free(entry);
+  }
+  if (!rs.acked) {
+    return;
+  }
+  tcp_retransmit_timer_update(pcb);
+  if (rtt) {
+    tcp_rtt_update(pcb, rtt);
+  }
+  pcb->delivered += rs.acked;
+  pcb->delivered_time = now;
+  timersub(&now, &prior_time, &diff);
+  rs.interval = diff.tv_sec * 1000000 + diff.tv_usec;
+  if (rs.interval) {
+    rs.rate = (pcb->delivered - rs.prior_delivered) * 1000000 / rs.interval;
+  }
+  rs.rtt = rtt;
+  rs.delivered = pcb->delivered;
+  rs.inflight = pcb->snd.nxt - pcb->snd.una;
+  if (pcb->cc.ops) {
+    pcb->cc.ops->ack(&pcb->cc, &rs);
+  }
+}
+
+static void tcp_retransmit_queue_discard(struct tcp_pcb *pcb) {
+  struct tcp_queue_entry *entry;
+
+  while ((entry = queue_pop(&pcb->queue)) != NULL) {
+    tcp_retransmit_queue_entry_free(entry);
+  }
+  net_timeout_cancel(&pcb->retransmit);
+}
+
+/*
+ * TCP Persist
+ *
+ * NOTE: TCP Persist functions must be called after mutex locked
+ */
+
+/* NOTE: called by a sender blocked on a zero window with nothing in flight, which no ACK is going to wake up */
+static void tcp_persist_timer_update(struct tcp_pcb *pcb) {
+  struct timeval expire;
+
+  if (net_timeout_pending(&pcb->persist)) {
+    return;
+  }
+  gettimeofday(&expire, NULL);
+  timeval_add_usec(&expire, MIN((uint64_t)pcb->rto << MIN(pcb->persist_backoff, 16), TCP_PERSIST_MAX));
+  net_timeout_arm(&pcb->persist, &expire);
+}
+
+/* NOTE: called when the window of the peer opens */
+static void tcp_persist_cancel(struct tcp_pcb *pcb) {
+  net_timeout_cancel(&pcb->persist);
+  pcb->persist_backoff = 0;
+}
+
+/* sends a zero window probe, an already acknowledged sequence number makes the peer answer with its window */
+static void tcp_persist_timeout(void *arg) {
+  struct tcp_pcb *pcb;
+
+  pcb = (struct tcp_pcb *)arg;
+  mutex_lock(&mutex);
+  /* NOTE: the pcb may have been released or the timer armed again while waiting for the mutex */
+  if (pcb->state == TCP_PCB_STATE_FREE || net_timeout_pending(&pcb->persist)) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  if (pcb->snd.wnd || pcb->snd.nxt != pcb->snd.una) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  tcp_output_segment(pcb->snd.una - 1, pcb->rcv.nxt, TCP_FLG_ACK, tcp_pcb_adv_wnd(pcb, TCP_FLG_ACK), NULL, 0, NULL, 0,
+                     0, &pcb->local, &pcb->foreign, pcb);
+  stats.window_probes++;
+  pcb->persist_backoff++;
+  tcp_persist_timer_update(pcb);
+  mutex_unlock(&mutex);
+}
+
+static void tcp_retransmit_queue_emit(void *arg, void *data) {
+  struct tcp_pcb *pcb;
+  struct tcp_queue_entry *entry;
+  struct timeval now, timeout;
+  uint8_t opt[TCP_OPT_LEN_MAX];
+  size_t optlen;
+
+  pcb = (struct tcp_pcb *)arg;
+  entry = (struct tcp_queue_entry *)data;
+  gettimeofday(&now, NULL);
+  timeout = entry->last;
+  timeval_add_usec(&timeout, entry->rto);
+  if (!timercmp(&now, &timeout, <)) {
+    optlen = TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN) ? tcp_options_build_syn(pcb, opt) : 0;
+    tcp_output_segment(entry->seq, pcb->rcv.nxt, entry->flg, tcp_pcb_adv_wnd(pcb, entry->flg), opt, optlen,
+                       entry->data, entry->len, pcb->mss, &pcb->local, &pcb->foreign, pcb);
+    stats.retransmits++;
+    entry->retransmits++;
+    entry->last = now;
+    entry->rto *= 2;
+  }
+}
+
+/* NOTE: walks the queue only when the oldest entry has timed out, idle or fully acked connections cost nothing */
+static void tcp_retransmit_timeout(void *arg) {
+  struct tcp_pcb *pcb;
+  struct tcp_queue_entry *entry;
+  struct timeval now, diff, timeout;
+
+  pcb = (struct tcp_pcb *)arg;
+  mutex_lock(&mutex);
+  /* NOTE: the pcb may have been released or the timer armed again while waiting for the mutex */
+  if (pcb->state == TCP_PCB_STATE_FREE || net_timeout_pending(&pcb->retransmit)) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  entry = queue_peek(&pcb->queue);
+  if (!entry) {
+    mutex_unlock(&mutex);
+    return;
+  }
+  gettimeofday(&now, NULL);
+  timersub(&now, &entry->first, &diff);
+  if (diff.tv_sec >= TCP_RETRANSMIT_DEADLINE) {
+    pcb->state = TCP_PCB_STATE_CLOSED;
+    sched_wakeup(&pcb->ctx);
+    mutex_unlock(&mutex);
+    return;
+  }
+  timeout = entry->last;
+  timeval_add_usec(&timeout, entry->rto);
+  if (!timercmp(&now, &timeout, <)) {
+    if (pcb->cc.ops) {
+      pcb->cc.ops->loss(&pcb->cc, pcb->snd.nxt - pcb->snd.una);
+    }
+    /* NOTE: the receiver may have discarded the data it selectively acknowledged, see rfc2018 section 8 */
+    pcb->sack.num = 0;
+    pcb->rack.tlp_out = 0;
+    pcb->rack.recovering = 0;
+  }
+  queue_foreach(&pcb->queue, tcp_retransmit_queue_emit, pcb);
+  tcp_retransmit_timer_update(pcb);
+  mutex_unlock(&mutex);
+}
+
+/*
+ * TCP Path MTU Discovery
+ *
+ * NOTE: Fragmentation Needed is not a sign of congestion, the segments too long for the path are only sent again in
+ * frames of the new MSS, see https://tools.ietf.org/html/rfc1191 section 6.4
+ */
+
+static void tcp_pmtu_retransmit_entry(void *arg, void *data) {
+  struct tcp_pcb *pcb = arg;
+  struct tcp_queue_entry *entry = data;
+  uint32_t left, right, end;
+  struct timeval now;
+
+  if (entry->len <= pcb->mss || TCP_FLG_ISSET(entry->flg, TCP_FLG_SYN) ||
+      !timercmp(&entry->last, &pcb->mss_lowered, <)) {
+    return; /* NOTE: sent in frames of the lowered MSS already */
+  }
+  end = tcp_queue_entry_end(entry);
+  for (left = entry->seq, right = end; tcp_sack_next_hole(pcb, &left, &right); left = right, right = end) {
+    tcp_output_segment(left, pcb->rcv.nxt, right == end ? entry->flg : entry->flg & ~TCP_FLG_FIN,
+                       tcp_pcb_adv_wnd(pcb, entry->flg), NULL, 0, entry->data + (left - entry->seq),
+                       TCP_SEQ_MIN(right, entry->seq + entry->len) - left, pcb->mss, &pcb->local, &pcb->foreign, pcb);
+    stats.retransmits++;
+  }
+  gettimeofday(&now, NULL);
+  entry->retransmits++;
+  entry->last = now;
+}
+
+/* NOTE: only Fragmentation Needed is acted upon, the other errors are soft, see rfc1122 section 4.2.3.9 */
+static void tcp_error(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, uint8_t type, uint8_t code,
+                      uint32_t info) {
+  struct tcp_hdr *hdr;
+  struct ip_endpoint local, foreign;
+  struct tcp_pcb *pcb;
+  uint32_t seq;
+
+  (void)len;
+  if (type != ICMP_TYPE_DEST_UNREACH || code != ICMP_CODE_FRAG_NEEDED) {
+    return;
+  }
+  hdr = (struct tcp_hdr *)data;
+  local.addr = src;
+  local.port = hdr->src;
+  foreign.addr = dst;
+  foreign.port = hdr->dst;
+  seq = ntoh32(hdr->seq);
+  mutex_lock(&mutex);
+  pcb = tcp_pcb_select(&local, &foreign);
+  if (!pcb || pcb->state == TCP_PCB_STATE_LISTEN || pcb->foreign.addr != dst || pcb->foreign.port != hdr->dst) {
+    mutex_unlock(&mutex);
     return;
   }
-  timeout = entry->last;
-  timeval_add_usec(&timeout, entry->rto);
-  if (timercmp(&now, &timeout, >)) {
-    tcp_output_segment(entry->seq, pcb->rcv.nxt, entry->flg, pcb->rcv.wnd, entry->data, entry->len, &pcb->local,
-                       &pcb->foreign);
-    entry->last = now;
-    entry->rto *= 2;
+  /* NOTE: an error quoting a sequence number not in flight is stale or forged, see rfc5927 section 4.1 */
+  if (TCP_SEQ_LT(seq, pcb->snd.una) || TCP_SEQ_GEQ(seq, pcb->snd.nxt)) {
+    mutex_unlock(&mutex);
+    return;
   }
+  ip_route_update_mtu(dst, info);
+  /* NOTE: the MSS may have been lowered already, by an output refused for the path MTU learned before this call */
+  tcp_pcb_set_path_mtu(pcb, ip_route_get_mtu(dst));
+  queue_foreach(&pcb->queue, tcp_pmtu_retransmit_entry, pcb);
+  tcp_retransmit_timer_update(pcb);
+  mutex_unlock(&mutex);
 }
 
-static ssize_t tcp_output(struct tcp_pcb *pcb, uint8_t flg, uint8_t *data, size_t len) {
+static ssize_t tcp_output_mapped(struct tcp_pcb *pcb, uint8_t flg, uint8_t *data, size_t len, struct tcp_mapping *map) {
   uint32_t seq;
+  uint8_t opt[TCP_OPT_LEN_MAX];
+  size_t optlen = 0;
 
   seq = pcb->snd.nxt;
   if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
     seq = pcb->iss;
+    optlen = tcp_options_build_syn(pcb, opt);
   }
   if (TCP_FLG_ISSET(flg, TCP_FLG_SYN | TCP_FLG_FIN) || len) {
-    tcp_retransmit_queue_add(pcb, seq, flg, data, len);
+    tcp_retransmit_queue_add(pcb, seq, flg, data, len, map);
+    tcp_tlp_timer_update(pcb);
   }
-  return tcp_output_segment(seq, pcb->rcv.nxt, flg, pcb->rcv.wnd, data, len, &pcb->local, &pcb->foreign);
+  return tcp_output_segment(seq, pcb->rcv.nxt, flg, tcp_pcb_adv_wnd(pcb, flg), opt, optlen, data, len, pcb->mss,
+                            &pcb->local, &pcb->foreign, pcb);
 }
 
-/* rfc793 - section 3.9 [Event Processing > SEGMENT ARRIVES] */
-static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uint8_t *data, size_t len,
-                                struct ip_endpoint *local, struct ip_endpoint *foreign) {
-  struct tcp_pcb *pcb;
+static ssize_t tcp_output(struct tcp_pcb *pcb, uint8_t flg, uint8_t *data, size_t len) {
+  return tcp_output_mapped(pcb, flg, data, len, NULL);
+}
+
+/*
+ * Header prediction (Van Jacobson)
+ *
+ * NOTE: takes the common cases on an established connection, in-order data and a pure ACK for new data, without
+ * walking through the event processing. Returns 0 if the segment is left to tcp_segment_arrives(), -1 on checksum
+ * error.
+ */
+static int tcp_header_predict(struct tcp_pcb *pcb, struct tcp_segment_info *seg, struct tcp_hdr *hdr, uint16_t hlen,
+                              size_t len, uint16_t psum) {
+  uint8_t *data = (uint8_t *)hdr + hlen;
+  uint32_t sum;
+
+  if (!pcb || pcb->state != TCP_PCB_STATE_ESTABLISHED) {
+    return 0;
+  }
+  if ((hdr->flg & ~TCP_FLG_PSH) != TCP_FLG_ACK || seg->seq != pcb->rcv.nxt ||
+      ((uint32_t)seg->wnd << pcb->snd.wscale) != pcb->snd.wnd) {
+    return 0;
+  }
+  if (!len) {
+    if (seg->ack <= pcb->snd.una || seg->ack > pcb->snd.nxt || seg->opt.sack_num || pcb->sack.num) {
+      return 0; /* NOTE: selective acknowledgments are left to the slow path */
+    }
+    if (cksum16((uint16_t *)hdr, hlen, psum) != 0) {
+      return -1;
+    }
+    uint32_t prior_una = pcb->snd.una;
+    pcb->snd.una = seg->ack;
+    tcp_retransmit_queue_cleanup(pcb);
+    tcp_rack_ack(pcb, seg, prior_una);
+    if (pcb->snd.wl1 < seg->seq || (pcb->snd.wl1 == seg->seq && pcb->snd.wl2 <= seg->ack)) {
+      pcb->snd.wl1 = seg->seq;
+      pcb->snd.wl2 = seg->ack;
+    }
+    sched_wakeup(&pcb->ctx);
+    stats.predicted_acks++;
+    return 1;
+  }
+  if (seg->ack != pcb->snd.una || len > pcb->rcv.wnd + tcp_rcvbuf_direct_room(pcb)) {
+    return 0;
+  }
+  /* NOTE: the checksum is verified while copying the data, which is discarded on error */
+  sum = tcp_rcvbuf_copy_csum(pcb, data, len);
+  if (cksum16((uint16_t *)hdr, hlen, psum + sum) != 0) {
+    return -1;
+  }
+  tcp_rcvbuf_commit(pcb, len);
+  pcb->rcv.nxt += len;
+  tcp_rcvbuf_rtt_update(pcb);
+  tcp_output(pcb, TCP_FLG_ACK, NULL, 0);
+  sched_wakeup(&pcb->ctx);
+  stats.predicted_data++;
+  return 1;
+}
 
-  pcb = tcp_pcb_select(local, foreign);
+/* rfc793 - section 3.9 [Event Processing > SEGMENT ARRIVES] */
+static void tcp_segment_arrives(struct tcp_pcb *pcb, struct tcp_segment_info *seg, uint8_t flags, uint8_t *data,
+                                size_t len, struct ip_endpoint *local, struct ip_endpoint *foreign) {
   if (!pcb || pcb->state == TCP_PCB_STATE_CLOSED) {
     if (TCP_FLG_ISSET(flags, TCP_FLG_RST)) {
       return;
     }
     if (!TCP_FLG_ISSET(flags, TCP_FLG_ACK)) {
-      tcp_output_segment(0, seg->seq + seg->len, TCP_FLG_RST | TCP_FLG_ACK, 0, NULL, 0, local, foreign);
+      tcp_output_segment(0, seg->seq + seg->len, TCP_FLG_RST | TCP_FLG_ACK, 0, NULL, 0, NULL, 0, 0, local, foreign,
+                         NULL);
     } else {
-      tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, local, foreign);
+      tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, NULL, 0, 0, local, foreign, NULL);
     }
     return;
   }
@@ -363,7 +2035,7 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
        * 2nd check for an ACK
        */
       if (TCP_FLG_ISSET(flags, TCP_FLG_ACK)) {
-        tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, local, foreign);
+        tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, NULL, 0, 0, local, foreign, NULL);
         return;
       }
 
@@ -375,14 +2047,34 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
         /* ignore: precedence check */
         pcb->local = *local;
         pcb->foreign = *foreign;
-        pcb->rcv.wnd = sizeof(pcb->buf);
+        tcp_hdr_template_init(&pcb->tmpl, &pcb->local, &pcb->foreign);
+        tcp_pcb_init_cc(pcb);
+        tcp_pcb_set_peer_mss(pcb, seg->opt.mss);
+        if (tcp_rcvbuf_init(pcb) == -1) {
+          errorf("tcp_rcvbuf_init() failure");
+          return;
+        }
+        if (seg->opt.wscale != -1) {
+          pcb->snd.wscale = seg->opt.wscale;
+          pcb->rcv.wscale = TCP_RCV_WSCALE;
+        }
+        pcb->sack.permitted = seg->opt.sack_permitted;
         pcb->rcv.nxt = seg->seq + 1;
         pcb->irs = seg->seq;
         pcb->iss = random();
+        /* NOTE: the data carried by the SYN is processed here only with a valid Fast Open cookie */
+        pcb->rcv.nxt += tcp_fastopen_accept(pcb, &seg->opt, data, len);
         tcp_output(pcb, TCP_FLG_SYN | TCP_FLG_ACK, NULL, 0);
         pcb->snd.nxt = pcb->iss + 1;
         pcb->snd.una = pcb->iss;
         pcb->state = TCP_PCB_STATE_SYN_RECEIVED;
+        if (pcb->fastopen.accepted) {
+          /* NOTE: the application may read the data and reply before the handshake completes */
+          pcb->snd.wnd = seg->wnd;
+          pcb->snd.wl1 = seg->seq;
+          pcb->snd.wl2 = seg->ack;
+          sched_wakeup(&pcb->ctx);
+        }
         /* ignore: Note that any other incoming control or data             */
         /* (combined with SYN) will be processed in the SYN-RECEIVED state, */
         /* but processing of SYN and ACK  should not be repeated            */
@@ -401,7 +2093,7 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
        */
       if (TCP_FLG_ISSET(flags, TCP_FLG_ACK)) {
         if (seg->ack <= pcb->iss || seg->ack > pcb->snd.nxt) {
-          tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, local, foreign);
+          tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, NULL, 0, 0, local, foreign, NULL);
           return;
         }
         if (pcb->snd.una <= seg->ack && seg->ack <= pcb->snd.nxt) {
@@ -423,7 +2115,27 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
       if (TCP_FLG_ISSET(flags, TCP_FLG_SYN)) {
         pcb->rcv.nxt = seg->seq + 1;
         pcb->irs = seg->seq;
+        tcp_pcb_set_peer_mss(pcb, seg->opt.mss);
+        if (seg->opt.wscale != -1) {
+          pcb->snd.wscale = seg->opt.wscale;
+        } else {
+          pcb->rcv.wscale = 0; /* both sides must send the option */
+        }
+        pcb->sack.permitted = seg->opt.sack_permitted;
+        pcb->rcv.adv = pcb->rcv.nxt + MIN(pcb->rcv.wnd, 0xffff); /* offered unscaled by the SYN */
+        if (pcb->fastopen.option && seg->opt.fastopen && seg->opt.cookie_len) {
+          tcp_fastopen_cache_update(pcb->foreign.addr, seg->opt.cookie, seg->opt.cookie_len, seg->opt.mss);
+        }
         if (acceptable) {
+          if (seg->ack != pcb->snd.nxt) {
+            /* the data carried by the SYN was not accepted, tcp_open_fastopen() sends it again */
+            pcb->snd.nxt = seg->ack;
+            if (!seg->opt.cookie_len) {
+              tcp_fastopen_cache_delete(pcb->foreign.addr);
+            }
+          } else if (pcb->snd.nxt - pcb->iss > 1) {
+            stats.fastopen_active++;
+          }
           pcb->snd.una = seg->ack;
           tcp_retransmit_queue_cleanup(pcb);
         }
@@ -529,7 +2241,7 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
         pcb->state = TCP_PCB_STATE_ESTABLISHED;
         sched_wakeup(&pcb->ctx);
       } else {
-        tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, local, foreign);
+        tcp_output_segment(seg->ack, 0, TCP_FLG_RST, 0, NULL, 0, NULL, 0, 0, local, foreign, NULL);
         return;
       }
       /* fall through */
@@ -537,16 +2249,24 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
     case TCP_PCB_STATE_FIN_WAIT1:
     case TCP_PCB_STATE_FIN_WAIT2:
     case TCP_PCB_STATE_CLOSE_WAIT:
-      if (pcb->snd.una < seg->ack && seg->ack <= pcb->snd.nxt) {
-        pcb->snd.una = seg->ack;
-        tcp_retransmit_queue_cleanup(pcb);
-        /* ignore: Users should receive positive acknowledgments for buffers
-                    which have been SENT and fully acknowledged (i.e., SEND buffer should be returned with "ok"
-           response) */
+      if (pcb->snd.una <= seg->ack && seg->ack <= pcb->snd.nxt) {
+        uint32_t prior_una = pcb->snd.una;
+        if (pcb->snd.una < seg->ack) {
+          pcb->snd.una = seg->ack;
+          tcp_retransmit_queue_cleanup(pcb);
+          /* ignore: Users should receive positive acknowledgments for buffers
+                      which have been SENT and fully acknowledged (i.e., SEND buffer should be returned with "ok"
+             response) */
+        }
+        tcp_rack_ack(pcb, seg, prior_una);
+        /* NOTE: a duplicate ACK may carry a window update, e.g. the answer to a zero window probe */
         if (pcb->snd.wl1 < seg->seq || (pcb->snd.wl1 == seg->seq && pcb->snd.wl2 <= seg->ack)) {
-          pcb->snd.wnd = seg->wnd;
+          pcb->snd.wnd = seg->wnd << pcb->snd.wscale;
           pcb->snd.wl1 = seg->seq;
           pcb->snd.wl2 = seg->ack;
+          if (pcb->snd.wnd) {
+            tcp_persist_cancel(pcb);
+          }
         }
         sched_wakeup(&pcb->ctx);
       } else if (seg->ack < pcb->snd.una) {
@@ -589,9 +2309,11 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
     case TCP_PCB_STATE_FIN_WAIT1:
     case TCP_PCB_STATE_FIN_WAIT2:
       if (len) {
-        memcpy(pcb->buf + (sizeof(pcb->buf) - pcb->rcv.wnd), data, len);
-        pcb->rcv.nxt = seg->seq + seg->len;
-        pcb->rcv.wnd -= len;
+        /* NOTE: trim the part already received, and drop out-of-order segments as there is no reassembly queue */
+        if (seg->seq <= pcb->rcv.nxt && pcb->rcv.nxt - seg->seq < len) {
+          pcb->rcv.nxt += tcp_rcvbuf_write(pcb, data + (pcb->rcv.nxt - seg->seq), len - (pcb->rcv.nxt - seg->seq));
+          tcp_rcvbuf_rtt_update(pcb);
+        }
         tcp_output(pcb, TCP_FLG_ACK, NULL, 0);
         sched_wakeup(&pcb->ctx);
       }
@@ -612,7 +2334,11 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
         /* drop segment */
         return;
     }
-    pcb->rcv.nxt = seg->seq + 1;
+    if (seg->seq + len != pcb->rcv.nxt) {
+      /* the FIN follows data not accepted, wait for the retransmission */
+      return;
+    }
+    pcb->rcv.nxt = seg->seq + seg->len;
     tcp_output(pcb, TCP_FLG_ACK, NULL, 0);
     switch (pcb->state) {
       case TCP_PCB_STATE_SYN_RECEIVED:
@@ -644,7 +2370,7 @@ static void tcp_segment_arrives(struct tcp_segment_info *seg, uint8_t flags, uin
   return;
 }
 
-static void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
+void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
   struct tcp_hdr *hdr;
   if (len < sizeof(*hdr)) {
     errorf("too short");
@@ -659,11 +2385,7 @@ static void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   pseudo.len = hton16(len);
   uint16_t psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), 0);
   hdr = (struct tcp_hdr *)data;
-  if (cksum16((uint16_t *)hdr, len, psum) != 0) {
-    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
-           ntoh16(cksum16((uint16_t *)hdr, len, -hdr->sum + psum)));
-    return;
-  }
+  /* NOTE: the checksum is verified later, by the header prediction along with the copy of the data */
 
   char addr1[IP_ADDR_STR_LEN];
   char addr2[IP_ADDR_STR_LEN];
@@ -686,6 +2408,10 @@ static void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   foreign.port = hdr->src;
 
   uint16_t hlen = (hdr->off >> 4) << 2;
+  if (hlen < sizeof(*hdr) || hlen > len) {
+    errorf("invalid header length: hlen=%u, len=%zu", hlen, len);
+    return;
+  }
 
   struct tcp_segment_info seg;
   seg.seq = ntoh32(hdr->seq);
@@ -699,25 +2425,84 @@ static void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   }
   seg.wnd = ntoh16(hdr->wnd);
   seg.up = ntoh16(hdr->up);
+  tcp_options_parse(hdr, hlen, &seg.opt);
 
   mutex_lock(&mutex);
-  tcp_segment_arrives(&seg, hdr->flg, (uint8_t *)hdr + hlen, len - hlen, &local, &foreign);
+  stats.segs_in++;
+  stats.gro_merged += gro_merged;
+  gro_merged = 0;
+  uint64_t start = cycle_counter();
+  struct tcp_pcb *pcb = tcp_pcb_select(&local, &foreign);
+  int ret = tcp_header_predict(pcb, &seg, hdr, hlen, len - hlen, psum);
+  if (ret == 1) {
+    stats.fastpath_cycles += cycle_counter() - start;
+  } else if (ret == 0 && cksum16((uint16_t *)hdr, len, psum) == 0) {
+    tcp_segment_arrives(pcb, &seg, hdr->flg, (uint8_t *)hdr + hlen, len - hlen, &local, &foreign);
+    stats.slowpath_cycles += cycle_counter() - start;
+  } else {
+    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
+           ntoh16(cksum16((uint16_t *)hdr, len, -hdr->sum + psum)));
+  }
   mutex_unlock(&mutex);
 
   return;
 }
 
-static void tcp_timer(void) {
-  struct tcp_pcb *pcb;
+/*
+ * Generic receive offload: appends the payload of the next in-order segment of the same flow to held
+ *
+ * NOTE: called by the softirq before tcp_input(). Nothing is verified here: the checksum of held is updated
+ * incrementally (see https://tools.ietf.org/html/rfc1624) with the sum of data, taken along with the copy, and what
+ * is left over from the checksum of data, so that the single verification of tcp_input() fails the merged segment if
+ * any of its parts is corrupted.
+ */
+static int tcp_gro_receive(uint8_t *held, size_t *len, size_t size, const uint8_t *data, size_t dlen, ip_addr_t src,
+                           ip_addr_t dst, unsigned int count) {
+  struct tcp_hdr *hdr1, *hdr2;
+  struct pseudo_hdr pseudo;
+  uint16_t hlen, psum, plen1, plen2, old, sum, residue;
+  uint32_t acc;
 
-  mutex_lock(&mutex);
-  for (pcb = pcbs; pcb < tailof(pcbs); pcb++) {
-    if (pcb->state == TCP_PCB_STATE_FREE) {
-      continue;
-    }
-    queue_foreach(&pcb->queue, tcp_retransmit_queue_emit, pcb);
+  hdr1 = (struct tcp_hdr *)held;
+  hdr2 = (struct tcp_hdr *)data;
+  if (*len < sizeof(*hdr1) || dlen < sizeof(*hdr2)) {
+    return 0;
   }
-  mutex_unlock(&mutex);
+  hlen = (hdr1->off >> 4) << 2;
+  if (hlen < sizeof(*hdr1) || hlen > *len || hdr2->off != hdr1->off || hlen > dlen) {
+    return 0;
+  }
+  plen1 = *len - hlen;
+  plen2 = dlen - hlen;
+  if (!plen1 || plen1 % 2 || !plen2 || *len + plen2 > size) {
+    return 0; /* NOTE: an odd length would misalign the 16-bit words of the checksum */
+  }
+  if (hdr1->flg != TCP_FLG_ACK || (hdr2->flg & ~TCP_FLG_PSH) != TCP_FLG_ACK) {
+    return 0; /* NOTE: PSH on held delivers it right away */
+  }
+  if (hdr1->src != hdr2->src || hdr1->dst != hdr2->dst || hdr1->ack != hdr2->ack || hdr1->wnd != hdr2->wnd ||
+      ntoh32(hdr2->seq) != ntoh32(hdr1->seq) + plen1 || memcmp(hdr1 + 1, hdr2 + 1, hlen - sizeof(*hdr1)) != 0) {
+    return 0;
+  }
+  sum = cksum16_copy(held + *len, data + hlen, plen2, 0);
+  pseudo.src = src;
+  pseudo.dst = dst;
+  pseudo.zero = 0;
+  pseudo.protocol = IP_PROTOCOL_TCP;
+  pseudo.len = hton16(dlen);
+  psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), sum);
+  residue = cksum16((uint16_t *)data, hlen, psum); /* 0 if data is intact */
+  old = *(uint16_t *)&hdr1->off;                   /* the word holding the flags */
+  hdr1->flg |= hdr2->flg;
+  acc = (uint16_t)~hdr1->sum + (uint16_t)~old + *(uint16_t *)&hdr1->off + (uint16_t)~hton16(*len) +
+        hton16(*len + plen2) + sum + residue;
+  while (acc >> 16) {
+    acc = (acc & 0xffff) + (acc >> 16);
+  }
+  hdr1->sum = ~acc;
+  *len += plen2;
+  gro_merged++;
+  return 1;
 }
 
 static void event_handler(void *arg) {
@@ -733,14 +2518,21 @@ static void event_handler(void *arg) {
 }
 
 int tcp_init(void) {
+  if (random_bytes(fastopen_key, sizeof(fastopen_key)) == -1 ||
+      random_bytes(reuseport_key, sizeof(reuseport_key)) == -1) {
+    errorf("random_bytes() failure");
+    return -1;
+  }
   if (ip_protocol_register(IP_PROTOCOL_TCP, tcp_input) == -1) {
     errorf("ip_protocol_register() failure");
     return -1;
   }
-
-  struct timeval interval = {0, 100000};
-  if (net_timer_register(interval, tcp_timer) == -1) {
-    errorf("net_timer_register() failure");
+  if (ip_protocol_register_gro(IP_PROTOCOL_TCP, tcp_gro_receive) == -1) {
+    errorf("ip_protocol_register_gro() failure");
+    return -1;
+  }
+  if (ip_protocol_register_err(IP_PROTOCOL_TCP, tcp_error) == -1) {
+    errorf("ip_protocol_register_err() failure");
     return -1;
   }
 
@@ -753,11 +2545,15 @@ int tcp_init(void) {
  * TCP User Command (RFC793)
  */
 
-int tcp_open_rfc793(struct ip_endpoint *local, struct ip_endpoint *foreign, int active) {
+static ssize_t tcp_send_core(struct tcp_pcb *pcb, uint8_t *data, size_t len, struct tcp_mapping *map);
+
+/* NOTE: data is sent with the SYN if possible (TCP Fast Open), otherwise right after the connection established */
+static int tcp_open(struct ip_endpoint *local, struct ip_endpoint *foreign, int active, uint8_t *data, size_t len) {
   struct tcp_pcb *pcb;
   char ep1[IP_ENDPOINT_STR_LEN];
   char ep2[IP_ENDPOINT_STR_LEN];
   int state, id;
+  size_t slen = 0, acked;
 
   mutex_lock(&mutex);
   pcb = tcp_pcb_alloc();
@@ -771,9 +2567,22 @@ int tcp_open_rfc793(struct ip_endpoint *local, struct ip_endpoint *foreign, int
            ip_endpoint_ntop(foreign, ep2, sizeof(ep2)));
     pcb->local = *local;
     pcb->foreign = *foreign;
-    pcb->rcv.wnd = sizeof(pcb->buf);
+    tcp_hdr_template_init(&pcb->tmpl, &pcb->local, &pcb->foreign);
+    tcp_pcb_init_cc(pcb);
+    if (tcp_rcvbuf_init(pcb) == -1) {
+      errorf("tcp_rcvbuf_init() failure");
+      pcb->state = TCP_PCB_STATE_CLOSED;
+      tcp_pcb_release(pcb);
+      mutex_unlock(&mutex);
+      return -1;
+    }
+    pcb->rcv.wscale = TCP_RCV_WSCALE;
+    pcb->sack.permitted = 1;
     pcb->iss = random();
-    if (tcp_output(pcb, TCP_FLG_SYN, NULL, 0) == -1) {
+    if (data) {
+      slen = tcp_fastopen_connect(pcb, len);
+    }
+    if (tcp_output(pcb, TCP_FLG_SYN, data, slen) == -1) {
       errorf("tcp_output() failure");
       pcb->state = TCP_PCB_STATE_CLOSED;
       tcp_pcb_release(pcb);
@@ -781,7 +2590,7 @@ int tcp_open_rfc793(struct ip_endpoint *local, struct ip_endpoint *foreign, int
       return -1;
     }
     pcb->snd.una = pcb->iss;
-    pcb->snd.nxt = pcb->iss + 1;
+    pcb->snd.nxt = pcb->iss + 1 + slen;
     pcb->state = TCP_PCB_STATE_SYN_SENT;
   } else {
     debugf("passive open: local=%s, waiting for connection...", ip_endpoint_ntop(local, ep1, sizeof(ep1)));
@@ -805,8 +2614,13 @@ AGAIN:
       return -1;
     }
   }
-  if (pcb->state != TCP_PCB_STATE_ESTABLISHED) {
+  /* NOTE: the peer may have already sent its reply and FIN, e.g. to a request carried by SYN */
+  if (pcb->state != TCP_PCB_STATE_ESTABLISHED && pcb->state != TCP_PCB_STATE_CLOSE_WAIT) {
     if (pcb->state == TCP_PCB_STATE_SYN_RECEIVED) {
+      if (pcb->fastopen.accepted) {
+        /* the application can read the data carried by the SYN right away */
+        goto ESTABLISHED;
+      }
       goto AGAIN;
     }
     errorf("open error: %d", pcb->state);
@@ -815,13 +2629,30 @@ AGAIN:
     mutex_unlock(&mutex);
     return -1;
   }
+ESTABLISHED:
   id = tcp_pcb_id(pcb);
   debugf("connection established: local=%s, foreign=%s", ip_endpoint_ntop(&pcb->local, ep1, sizeof(ep1)),
          ip_endpoint_ntop(&pcb->foreign, ep2, sizeof(ep2)));
+  if (data) {
+    acked = pcb->snd.una - (pcb->iss + 1); /* the data acknowledged by SYN-ACK */
+    if (acked < len && tcp_send_core(pcb, data + acked, len - acked, NULL) == -1) {
+      errorf("tcp_send_core() failure");
+      mutex_unlock(&mutex);
+      return -1;
+    }
+  }
   mutex_unlock(&mutex);
   return id;
 }
 
+int tcp_open_rfc793(struct ip_endpoint *local, struct ip_endpoint *foreign, int active) {
+  return tcp_open(local, foreign, active, NULL, 0);
+}
+
+int tcp_open_fastopen(struct ip_endpoint *local, struct ip_endpoint *foreign, uint8_t *data, size_t len) {
+  return tcp_open(local, foreign, 1, data, len);
+}
+
 int tcp_close(int id) {
   struct tcp_pcb *pcb;
 
@@ -834,6 +2665,7 @@ int tcp_close(int id) {
   }
 
   switch (pcb->state) {
+    case TCP_PCB_STATE_SYN_RECEIVED: /* returned by a passive open with TCP Fast Open */
     case TCP_PCB_STATE_ESTABLISHED:
       tcp_output(pcb, TCP_FLG_ACK | TCP_FLG_FIN, NULL, 0);
       pcb->snd.nxt++;
@@ -860,37 +2692,55 @@ int tcp_close(int id) {
   return 0;
 }
 
-ssize_t tcp_send(int id, uint8_t *data, size_t len) {
-  struct tcp_pcb *pcb;
+/*
+ * Bytes to put in a segment, it is split into frames of MSS by the IP layer. A batch is limited to what the pacing
+ * rate allows in a quantum so as not to defeat the pacing.
+ *
+ * NOTE: must be called after mutex locked
+ */
+static size_t tcp_gso_size_goal(struct tcp_pcb *pcb) {
+  size_t goal;
+  uint64_t rate;
+
+  goal = (IP_PAYLOAD_SIZE_MAX - sizeof(struct tcp_hdr)) / pcb->mss * pcb->mss;
+  rate = tcp_pacing_rate(pcb);
+  if (rate) {
+    goal = MIN(goal, MAX(rate * TCP_PACING_QUANTUM / 1000000, pcb->mss));
+  }
+  return goal;
+}
+
+/* NOTE: must be called after mutex locked */
+static ssize_t tcp_send_core(struct tcp_pcb *pcb, uint8_t *data, size_t len, struct tcp_mapping *map) {
   ssize_t sent = 0;
-  struct ip_iface *iface;
-  size_t mss, cap, slen;
+  size_t mss, wnd, inflight, cap, slen;
+  struct timespec abstime;
 
-  mutex_lock(&mutex);
-  pcb = tcp_pcb_get(id);
-  if (!pcb) {
-    errorf("pcb not found");
-    mutex_unlock(&mutex);
-    return -1;
-  }
 RETRY:
   switch (pcb->state) {
-    case TCP_PCB_STATE_ESTABLISHED:
-    case TCP_PCB_STATE_CLOSE_WAIT:
-      iface = ip_route_get_iface(pcb->foreign.addr);
-      if (!iface) {
-        errorf("iface not found");
-        mutex_unlock(&mutex);
+    case TCP_PCB_STATE_SYN_RECEIVED:
+      if (!pcb->fastopen.accepted) {
+        errorf("unknown state '%u'", pcb->state);
         return -1;
       }
-      mss = NET_IFACE(iface)->dev->mtu - (IP_HDR_SIZE_MIN + sizeof(struct tcp_hdr));
+      /* fall through */
+    case TCP_PCB_STATE_ESTABLISHED:
+    case TCP_PCB_STATE_CLOSE_WAIT:
+      mss = pcb->mss;
       while (sent < (ssize_t)len) {
-        cap = pcb->snd.wnd - (pcb->snd.nxt - pcb->snd.una);
+        wnd = MIN(pcb->snd.wnd, pcb->cc.cwnd);
+        inflight = pcb->snd.nxt - pcb->snd.una;
+        cap = wnd > inflight ? wnd - inflight : 0;
+        if (inflight && cap < MIN(mss, len - sent)) {
+          cap = 0; /* wait for a full-sized segment to fit rather than sending a sliver */
+        }
         if (!cap) {
+          if (!inflight) {
+            tcp_persist_timer_update(pcb); /* zero window */
+          }
           if (sched_sleep(&pcb->ctx, &mutex, NULL) == -1) {
             debugf("interrupted");
             if (!sent) {
-              mutex_unlock(&mutex);
               errno = EINTR;
               return -1;
             }
@@ -898,35 +2748,167 @@ RETRY:
           }
           goto RETRY;
         }
-        slen = MIN(MIN(mss, len - sent), cap);
-        if (tcp_output(pcb, TCP_FLG_ACK | TCP_FLG_PSH, data + sent, slen) == -1) {
+        if (tcp_pacing_delay(pcb, &abstime)) {
+          stats.pacing_waits++;
+          if (sched_sleep(&pcb->ctx, &mutex, &abstime) == -1) {
+            debugf("interrupted");
+            if (!sent) {
+              errno = EINTR;
+              return -1;
+            }
+            break;
+          }
+          goto RETRY;
+        }
+        slen = MIN(tcp_gso_size_goal(pcb), cap);
+        if (slen > mss) {
+          slen -= slen % mss; /* full-sized frames only, but the last one of the data */
+        }
+        slen = MIN(slen, len - sent);
+        if (tcp_output_mapped(pcb, TCP_FLG_ACK | TCP_FLG_PSH, data + sent, slen, map) == -1) {
           errorf("tcp_output() failure");
           pcb->state = TCP_PCB_STATE_CLOSED;
           tcp_pcb_release(pcb);
-          mutex_unlock(&mutex);
           return -1;
         }
         pcb->snd.nxt += slen;
         sent += slen;
+        tcp_pacing_update(pcb, slen);
       }
       break;
     case TCP_PCB_STATE_LAST_ACK:
       errorf("connection closing");
-      mutex_unlock(&mutex);
-      return -1;
+      return sent ? sent : -1; /* NOTE: closed while waiting, what has been queued is still delivered */
     default:
       errorf("unknown state '%u'", pcb->state);
-      mutex_unlock(&mutex);
-      return -1;
+      return sent ? sent : -1;
+  }
+  return sent;
+}
+
+ssize_t tcp_send(int id, uint8_t *data, size_t len) {
+  struct tcp_pcb *pcb;
+  ssize_t sent;
+
+  mutex_lock(&mutex);
+  pcb = tcp_pcb_get(id);
+  if (!pcb) {
+    errorf("pcb not found");
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  sent = tcp_send_core(pcb, data, len, NULL);
+  mutex_unlock(&mutex);
+  return sent;
+}
+
+/* NOTE: segments are built straight from the mapped pages, which stay mapped until they are acknowledged */
+ssize_t tcp_sendfile(int id, int fd, off_t offset, size_t len) {
+  struct tcp_pcb *pcb;
+  struct stat st;
+  struct tcp_mapping *map;
+  uint8_t *data;
+  ssize_t sent;
+
+  if (fstat(fd, &st) == -1) {
+    errorf("fstat: %s", strerror(errno));
+    return -1;
+  }
+  if (offset >= st.st_size) {
+    return 0;
+  }
+  len = MIN(len, (size_t)(st.st_size - offset)); /* touching the pages beyond EOF raises SIGBUS */
+  if (!len) {
+    return 0;
+  }
+
+  mutex_lock(&mutex);
+  pcb = tcp_pcb_get(id);
+  if (!pcb) {
+    errorf("pcb not found");
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  map = tcp_mapping_create(fd, offset, len, &data);
+  if (!map) {
+    errorf("tcp_mapping_create() failure");
+    mutex_unlock(&mutex);
+    return -1;
   }
+  sent = tcp_send_core(pcb, data, len, map);
+  tcp_mapping_put(map);
+  mutex_unlock(&mutex);
+  return sent;
+}
+
+/*
+ * NOTE: the retransmit entries refer to the buffer and each frame is filled straight from it by the IP layer (see
+ * tcp_output_segment()), it must be left untouched until its cookie is reaped.
+ */
+ssize_t tcp_send_zc(int id, uint8_t *data, size_t len, uint64_t cookie) {
+  struct tcp_pcb *pcb;
+  struct tcp_mapping *map;
+  ssize_t sent;
 
+  mutex_lock(&mutex);
+  pcb = tcp_pcb_get(id);
+  if (!pcb) {
+    errorf("pcb not found");
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  map = tcp_mapping_lend(pcb, data, len, cookie);
+  if (!map) {
+    errorf("tcp_mapping_lend() failure");
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  sent = tcp_send_core(pcb, data, len, map);
+  if (sent == -1 && tcp_pcb_get(id) != pcb) {
+    /* NOTE: released with the connection */
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  if (sent == -1 && map->ref == 1) {
+    /* NOTE: no segment refers to the buffer, it is given back without a completion */
+    queue_remove(&pcb->zc, map);
+    memory_free(map);
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  tcp_mapping_put(map);
   mutex_unlock(&mutex);
   return sent;
 }
 
+/* NOTE: waits for at least one completion, returns 0 if no buffer is pending */
+ssize_t tcp_zc_reap(int id, uint64_t *cookies, size_t n) {
+  struct tcp_pcb *pcb;
+  size_t count;
+
+  mutex_lock(&mutex);
+  pcb = tcp_pcb_get(id);
+  if (!pcb) {
+    errorf("pcb not found");
+    mutex_unlock(&mutex);
+    return -1;
+  }
+  while (!(count = tcp_mapping_reap(pcb, cookies, n)) && queue_peek(&pcb->zc)) {
+    if (sched_sleep(&pcb->ctx, &mutex, NULL) == -1) {
+      debugf("interrupted");
+      mutex_unlock(&mutex);
+      errno = EINTR;
+      return -1;
+    }
+  }
+  mutex_unlock(&mutex);
+  return count;
+}
+
 ssize_t tcp_receive(int id, uint8_t *buf, size_t size) {
   struct tcp_pcb *pcb;
   size_t remain, len;
+  int lent, ret;
 
   mutex_lock(&mutex);
   pcb = tcp_pcb_get(id);
@@ -937,10 +2919,28 @@ ssize_t tcp_receive(int id, uint8_t *buf, size_t size) {
   }
 RETRY:
   switch (pcb->state) {
+    case TCP_PCB_STATE_SYN_RECEIVED: /* returned by a passive open with TCP Fast Open */
     case TCP_PCB_STATE_ESTABLISHED:
-      remain = sizeof(pcb->buf) - pcb->rcv.wnd;
+      remain = pcb->rcvbuf.size - pcb->rcv.wnd;
       if (!remain) {
-        if (sched_sleep(&pcb->ctx, &mutex, NULL) == -1) {
+        /* NOTE: lend the buffer, the data arriving while sleeping is delivered straight into it */
+        lent = !pcb->reader.buf;
+        if (lent) {
+          pcb->reader.buf = buf;
+          pcb->reader.size = size;
+          pcb->reader.len = 0;
+        }
+        ret = sched_sleep(&pcb->ctx, &mutex, NULL);
+        len = 0;
+        if (lent) {
+          len = pcb->reader.len;
+          memset(&pcb->reader, 0, sizeof(pcb->reader));
+        }
+        if (len) {
+          /* NOTE: the data has left the connection, it must be returned even if interrupted */
+          goto DELIVERED;
+        }
+        if (ret == -1) {
           debugf("interrupted");
           mutex_unlock(&mutex);
           errno = EINTR;
@@ -950,7 +2950,7 @@ RETRY:
       }
       break;
     case TCP_PCB_STATE_CLOSE_WAIT:
-      remain = sizeof(pcb->buf) - pcb->rcv.wnd;
+      remain = pcb->rcvbuf.size - pcb->rcv.wnd;
       if (remain) {
         break;
       }
@@ -962,10 +2962,64 @@ RETRY:
       mutex_unlock(&mutex);
       return -1;
   }
-  len = MIN(size, remain);
-  memcpy(buf, pcb->buf, len);
-  memmove(pcb->buf, pcb->buf + len, remain - len);
-  pcb->rcv.wnd += len;
+  len = tcp_rcvbuf_read(pcb, buf, size);
+DELIVERED:
+  /* NOTE: a sender having filled the window waits for the update, sent once the window opens enough */
+  if (tcp_rcvbuf_adjust(pcb, len) || tcp_pcb_wnd_opening(pcb) >= tcp_pcb_sws_threshold(pcb)) {
+    stats.window_updates++;
+    tcp_output(pcb, TCP_FLG_ACK, NULL, 0);
+  }
   mutex_unlock(&mutex);
   return len;
 }
+
+int tcp_set_congestion_control(const char *name) {
+  const struct tcp_cc_ops *ops;
+
+  ops = tcp_cc_lookup(name);
+  if (!ops) {
+    errorf("unknown congestion control, name=%s", name);
+    return -1;
+  }
+  mutex_lock(&mutex);
+  cc_default = ops;
+  mutex_unlock(&mutex);
+  infof("default congestion control: %s", ops->name);
+  return 0;
+}
+
+void tcp_get_stats(struct tcp_stats *dst) {
+  mutex_lock(&mutex);
+  *dst = stats;
+  mutex_unlock(&mutex);
+}
+
+size_t tcp_metrics_dump(struct tcp_metrics *metrics, size_t n) {
+  struct tcp_metrics *entry;
+  size_t count = 0;
+
+  mutex_lock(&mutex);
+  for (entry = metrics_caches; entry < tailof(metrics_caches) && count < n; entry++) {
+    if (entry->addr && tcp_metrics_select(entry->addr)) {
+      metrics[count++] = *entry;
+    }
+  }
+  mutex_unlock(&mutex);
+  return count;
+}
+
+void tcp_metrics_flush(void) {
+  mutex_lock(&mutex);
+  memset(metrics_caches, 0, sizeof(metrics_caches));
+  mutex_unlock(&mutex);
+  infof("metrics flushed");
+}
+
+int tcp_set_fastopen(int flags) {
+  mutex_lock(&mutex);
+  fastopen = flags & (TCP_FASTOPEN_CLIENT | TCP_FASTOPEN_SERVER);
+  mutex_unlock(&mutex);
+  infof("fast open: client=%s, server=%s", flags & TCP_FASTOPEN_CLIENT ? "on" : "off",
+        flags & TCP_FASTOPEN_SERVER ? "on" : "off");
+  return 0;
+}
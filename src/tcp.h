@@ -2,13 +2,71 @@
 #ifndef TCP_H
 #define TCP_H
 
+#include <stdint.h>
+#include <sys/time.h>
+
 #include "ip.h"
 
+struct tcp_stats {
+  uint64_t segs_in;
+  uint64_t segs_out;
+  uint64_t retransmits;
+  uint64_t pacing_waits;         /* times a sender slept to keep to its pacing rate */
+  uint64_t fastopen_cookie_reqs; /* SYNs sent without a cached cookie */
+  uint64_t fastopen_active;      /* SYNs sent whose data was acknowledged by SYN-ACK */
+  uint64_t fastopen_passive;     /* SYNs received whose data was accepted */
+  uint64_t rcvbuf_grows;         /* receive buffers grown to keep up with the application */
+  uint64_t rcvbuf_shrinks;       /* receive buffers released on idle connections */
+  uint64_t predicted_acks;       /* pure ACKs taken by the header prediction */
+  uint64_t predicted_data;       /* in-order data segments taken by the header prediction */
+  uint64_t fastpath_cycles;      /* cycles spent on the segments taken by the header prediction */
+  uint64_t slowpath_cycles;      /* cycles spent on the other segments */
+  uint64_t gso_batches;          /* segments split into frames by the IP layer, segs_out counts the frames */
+  uint64_t gro_merged;           /* segments merged into the previous one before tcp_input, not in segs_in */
+  uint64_t window_updates;       /* ACKs sent because the application has opened the receive window */
+  uint64_t window_probes;        /* zero window probes sent */
+  uint64_t rack_retransmits;     /* retransmissions of the segments deemed lost by RACK, also in retransmits */
+  uint64_t tlp_probes;           /* tail loss probes sent, also in retransmits */
+  uint64_t reuseport_steered;    /* segments for which a listener was picked from a reuseport group */
+  uint64_t direct_copies;        /* segments copied straight into the buffer of a reader blocked in tcp_receive() */
+  uint64_t zc_completions;       /* buffers of tcp_send_zc() no longer referenced, read only to fill the frames */
+  uint64_t pmtu_shrinks;         /* MSS lowered to fit a path MTU learned after the connection was opened */
+};
+
+/* what the past connections have learned about a destination */
+struct tcp_metrics {
+  ip_addr_t addr;
+  uint32_t srtt;     /* micro seconds */
+  uint32_t rttvar;   /* micro seconds */
+  uint32_t ssthresh; /* bytes, 0 if no loss has been seen */
+  uint32_t cwnd;     /* bytes, when the last connection was released */
+  uint16_t mtu;      /* path MTU */
+  struct timeval timestamp;
+};
+
+#define TCP_FASTOPEN_CLIENT 0x01
+#define TCP_FASTOPEN_SERVER 0x02
+
+extern void tcp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface);
 extern int tcp_init(void);
+extern int tcp_set_congestion_control(const char *name); /* for connections opened afterwards */
+extern int tcp_set_fastopen(int flags);                  /* TCP_FASTOPEN_CLIENT (default) and/or TCP_FASTOPEN_SERVER */
+extern void tcp_get_stats(struct tcp_stats *stats);
+extern size_t tcp_metrics_dump(struct tcp_metrics *metrics, size_t n); /* returns the number of entries copied */
+extern void tcp_metrics_flush(void);
 
 extern int tcp_open_rfc793(struct ip_endpoint *local, struct ip_endpoint *foreign, int active);
+extern int tcp_open_fastopen(struct ip_endpoint *local, struct ip_endpoint *foreign, uint8_t *data, size_t len);
 extern int tcp_close(int id);
 extern ssize_t tcp_send(int id, uint8_t *data, size_t len);
+extern ssize_t tcp_sendfile(int id, int fd, off_t offset, size_t len);
+/*
+ * the buffer of tcp_send_zc() belongs to the stack until tcp_zc_reap() returns its cookie. On -1, no part of it has
+ * been queued and no completion comes. When the connection is released (closed, reset or aborted), the stack gives up
+ * every buffer at once: they may be reused, and the cookies not reaped yet are never reported.
+ */
+extern ssize_t tcp_send_zc(int id, uint8_t *data, size_t len, uint64_t cookie);
+extern ssize_t tcp_zc_reap(int id, uint64_t *cookies, size_t n);
 extern ssize_t tcp_receive(int id, uint8_t *buf, size_t size);
 
 #endif
@@ -0,0 +1,248 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "tcp_cc.h"
+#include "util.h"
+
+/*
+ * BBR (model-based), see https://datatracker.ietf.org/doc/html/draft-cardwell-iccrg-bbr-congestion-control-00
+ */
+
+#define BBR_MODE_STARTUP 0
+#define BBR_MODE_DRAIN 1
+#define BBR_MODE_PROBE_BW 2
+#define BBR_MODE_PROBE_RTT 3
+
+#define BBR_UNIT 256 /* fixed-point unit of the gains */
+
+#define BBR_HIGH_GAIN 739    /* 2/ln(2) */
+#define BBR_DRAIN_GAIN 88    /* ln(2)/2 */
+#define BBR_CWND_GAIN 512    /* 2 */
+#define BBR_FULL_BW_GAIN 320 /* 1.25 */
+#define BBR_FULL_BW_COUNT 3  /* rounds */
+
+#define BBR_BW_FILTER_LEN 10          /* rounds */
+#define BBR_MIN_RTT_WINDOW 10000000   /* micro seconds */
+#define BBR_PROBE_RTT_DURATION 200000 /* micro seconds */
+#define BBR_PROBE_RTT_CWND 4          /* segments */
+#define BBR_CWND_QUANTA 3             /* segments */
+#define BBR_CYCLE_LEN countof(pacing_gain)
+
+static const uint32_t pacing_gain[] = {320, 192, 256, 256, 256, 256, 256, 256};
+
+struct bbr {
+  int mode;
+  uint64_t bw[BBR_BW_FILTER_LEN]; /* max delivery rate of the recent rounds */
+  uint64_t round;
+  uint64_t next_round_delivered;
+  uint32_t min_rtt; /* micro seconds */
+  struct timeval min_rtt_stamp;
+  struct timeval probe_rtt_done;
+  uint64_t full_bw;
+  int full_bw_count;
+  int full_bw_reached;
+  unsigned int cycle_index;
+  struct timeval cycle_stamp;
+  uint32_t pacing_gain;
+  uint32_t cwnd_gain;
+};
+
+#define BBR(x) ((struct bbr *)(x)->priv)
+
+static long bbr_elapsed(const struct timeval *now, const struct timeval *since) {
+  struct timeval diff;
+
+  timersub(now, since, &diff);
+  return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+static uint64_t bbr_max_bw(struct bbr *bbr) {
+  uint64_t bw = 0;
+  int i;
+
+  for (i = 0; i < BBR_BW_FILTER_LEN; i++) {
+    bw = MAX(bw, bbr->bw[i]);
+  }
+  return bw;
+}
+
+static uint32_t bbr_target_cwnd(struct tcp_cc *cc, uint32_t gain) {
+  struct bbr *bbr = BBR(cc);
+  uint64_t bdp;
+
+  if (!bbr->min_rtt || !bbr_max_bw(bbr)) {
+    return TCP_CC_INIT_CWND * cc->mss;
+  }
+  bdp = bbr_max_bw(bbr) * bbr->min_rtt / 1000000;
+  return MIN(bdp * gain / BBR_UNIT + BBR_CWND_QUANTA * cc->mss, UINT32_MAX);
+}
+
+static void bbr_set_mode(struct tcp_cc *cc, int mode, const struct timeval *now) {
+  struct bbr *bbr = BBR(cc);
+
+  bbr->mode = mode;
+  switch (mode) {
+    case BBR_MODE_STARTUP:
+      bbr->pacing_gain = BBR_HIGH_GAIN;
+      bbr->cwnd_gain = BBR_HIGH_GAIN;
+      break;
+    case BBR_MODE_DRAIN:
+      bbr->pacing_gain = BBR_DRAIN_GAIN;
+      bbr->cwnd_gain = BBR_HIGH_GAIN;
+      break;
+    case BBR_MODE_PROBE_BW:
+      bbr->cycle_index = 2; /* start cruising, not probing */
+      bbr->cycle_stamp = *now;
+      bbr->pacing_gain = pacing_gain[bbr->cycle_index];
+      bbr->cwnd_gain = BBR_CWND_GAIN;
+      break;
+    case BBR_MODE_PROBE_RTT:
+      bbr->pacing_gain = BBR_UNIT;
+      bbr->cwnd_gain = BBR_UNIT;
+      timerclear(&bbr->probe_rtt_done);
+      break;
+  }
+}
+
+static void bbr_init(struct tcp_cc *cc) {
+  struct bbr *bbr = BBR(cc);
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  bbr->min_rtt_stamp = now;
+  bbr_set_mode(cc, BBR_MODE_STARTUP, &now);
+}
+
+static void bbr_update_bw(struct tcp_cc *cc, const struct tcp_cc_sample *rs, int *round_start) {
+  struct bbr *bbr = BBR(cc);
+
+  *round_start = 0;
+  if (rs->prior_delivered >= bbr->next_round_delivered) {
+    bbr->next_round_delivered = rs->delivered;
+    bbr->round++;
+    bbr->bw[bbr->round % BBR_BW_FILTER_LEN] = 0;
+    *round_start = 1;
+  }
+  if (rs->rate && bbr->min_rtt && rs->interval >= bbr->min_rtt) {
+    /* NOTE: samples taken over less than min_rtt are inflated by ACK compression */
+    bbr->bw[bbr->round % BBR_BW_FILTER_LEN] = MAX(bbr->bw[bbr->round % BBR_BW_FILTER_LEN], rs->rate);
+  }
+}
+
+static void bbr_check_full_bw(struct tcp_cc *cc, int round_start) {
+  struct bbr *bbr = BBR(cc);
+  uint64_t bw;
+
+  if (bbr->full_bw_reached || !round_start) {
+    return;
+  }
+  bw = bbr_max_bw(bbr);
+  if (bw >= bbr->full_bw * BBR_FULL_BW_GAIN / BBR_UNIT) {
+    bbr->full_bw = bw;
+    bbr->full_bw_count = 0;
+    return;
+  }
+  if (++bbr->full_bw_count >= BBR_FULL_BW_COUNT) {
+    bbr->full_bw_reached = 1;
+  }
+}
+
+static void bbr_update_mode(struct tcp_cc *cc, const struct tcp_cc_sample *rs, const struct timeval *now) {
+  struct bbr *bbr = BBR(cc);
+
+  switch (bbr->mode) {
+    case BBR_MODE_STARTUP:
+      if (bbr->full_bw_reached) {
+        bbr_set_mode(cc, BBR_MODE_DRAIN, now);
+      }
+      break;
+    case BBR_MODE_DRAIN:
+      if (rs->inflight <= bbr_target_cwnd(cc, BBR_UNIT)) {
+        bbr_set_mode(cc, BBR_MODE_PROBE_BW, now);
+      }
+      break;
+    case BBR_MODE_PROBE_BW:
+      if (bbr_elapsed(now, &bbr->cycle_stamp) > (long)bbr->min_rtt) {
+        bbr->cycle_index = (bbr->cycle_index + 1) % BBR_CYCLE_LEN;
+        bbr->cycle_stamp = *now;
+        bbr->pacing_gain = pacing_gain[bbr->cycle_index];
+      }
+      break;
+    case BBR_MODE_PROBE_RTT:
+      if (!timerisset(&bbr->probe_rtt_done)) {
+        if (rs->inflight <= BBR_PROBE_RTT_CWND * cc->mss) {
+          bbr->probe_rtt_done = *now;
+          timeval_add_usec(&bbr->probe_rtt_done, BBR_PROBE_RTT_DURATION);
+        }
+      } else if (timercmp(now, &bbr->probe_rtt_done, >)) {
+        bbr->min_rtt_stamp = *now;
+        bbr_set_mode(cc, bbr->full_bw_reached ? BBR_MODE_PROBE_BW : BBR_MODE_STARTUP, now);
+      }
+      break;
+  }
+}
+
+static void bbr_update_min_rtt(struct tcp_cc *cc, const struct tcp_cc_sample *rs, const struct timeval *now) {
+  struct bbr *bbr = BBR(cc);
+  int expired;
+
+  expired = bbr_elapsed(now, &bbr->min_rtt_stamp) > BBR_MIN_RTT_WINDOW;
+  if (rs->rtt && (!bbr->min_rtt || rs->rtt <= bbr->min_rtt || expired)) {
+    bbr->min_rtt = rs->rtt;
+    bbr->min_rtt_stamp = *now;
+  }
+  if (expired && bbr->mode != BBR_MODE_PROBE_RTT) {
+    bbr_set_mode(cc, BBR_MODE_PROBE_RTT, now);
+  }
+}
+
+static void bbr_ack(struct tcp_cc *cc, const struct tcp_cc_sample *rs) {
+  struct bbr *bbr = BBR(cc);
+  struct timeval now;
+  int round_start;
+  uint64_t rate;
+  uint32_t target;
+
+  gettimeofday(&now, NULL);
+  bbr_update_bw(cc, rs, &round_start);
+  bbr_check_full_bw(cc, round_start);
+  bbr_update_min_rtt(cc, rs, &now);
+  bbr_update_mode(cc, rs, &now);
+
+  /* pacing rate */
+  if (!cc->pacing_rate && rs->rtt) {
+    /* initial rate before having a reliable bandwidth estimate */
+    cc->pacing_rate = (uint64_t)cc->cwnd * 1000000 / rs->rtt * BBR_HIGH_GAIN / BBR_UNIT;
+  }
+  rate = bbr_max_bw(bbr) * bbr->pacing_gain / BBR_UNIT;
+  if (bbr->full_bw_reached || rate > cc->pacing_rate) {
+    /* NOTE: never slow down in STARTUP, early samples underestimate the bandwidth */
+    cc->pacing_rate = rate;
+  }
+
+  /* congestion window */
+  target = bbr_target_cwnd(cc, bbr->cwnd_gain);
+  if (bbr->full_bw_reached) {
+    cc->cwnd = MIN(cc->cwnd + rs->acked, target);
+  } else if (cc->cwnd < target || rs->delivered < TCP_CC_INIT_CWND * cc->mss) {
+    cc->cwnd += rs->acked;
+  }
+  cc->cwnd = MAX(cc->cwnd, BBR_PROBE_RTT_CWND * cc->mss);
+  if (bbr->mode == BBR_MODE_PROBE_RTT) {
+    cc->cwnd = MIN(cc->cwnd, BBR_PROBE_RTT_CWND * cc->mss);
+  }
+}
+
+static void bbr_loss(struct tcp_cc *cc, uint32_t inflight) {
+  /* BBR does not react to loss other than a retransmission timeout, where it restarts from one segment */
+  cc->cwnd = cc->mss;
+}
+
+const struct tcp_cc_ops tcp_cc_bbr = {
+    .name = "bbr",
+    .init = bbr_init,
+    .ack = bbr_ack,
+    .loss = bbr_loss,
+};
@@ -0,0 +1,66 @@
+#include "tcp_cc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+
+static const struct tcp_cc_ops *algorithms[] = {
+    &tcp_cc_reno,
+    &tcp_cc_bbr,
+};
+
+const struct tcp_cc_ops *tcp_cc_lookup(const char *name) {
+  const struct tcp_cc_ops **ops;
+
+  for (ops = algorithms; ops < tailof(algorithms); ops++) {
+    if (strncmp((*ops)->name, name, TCP_CC_NAME_LEN) == 0) {
+      return *ops;
+    }
+  }
+  return NULL;
+}
+
+void tcp_cc_init(struct tcp_cc *cc, const struct tcp_cc_ops *ops, uint32_t mss) {
+  memset(cc, 0, sizeof(*cc));
+  cc->ops = ops;
+  cc->mss = mss;
+  cc->cwnd = TCP_CC_INIT_CWND * mss;
+  cc->ssthresh = UINT32_MAX;
+  if (cc->ops->init) {
+    cc->ops->init(cc);
+  }
+}
+
+/*
+ * Reno (loss-based), see https://tools.ietf.org/html/rfc5681
+ */
+
+static void reno_ack(struct tcp_cc *cc, const struct tcp_cc_sample *rs) {
+  if (cc->cwnd < cc->ssthresh) {
+    /* slow start */
+    cc->cwnd += MIN(rs->acked, 2 * cc->mss); /* appropriate byte counting (L=2), see rfc3465 */
+    return;
+  }
+  /* congestion avoidance */
+  cc->cwnd += MAX((uint64_t)cc->mss * rs->acked / cc->cwnd, 1);
+}
+
+static void reno_loss(struct tcp_cc *cc, uint32_t inflight) {
+  cc->ssthresh = MAX(inflight / 2, TCP_CC_MIN_CWND * cc->mss);
+  cc->cwnd = cc->mss;
+}
+
+/* fast recovery without the window inflation, the lost segments are already sent again by RACK */
+static void reno_recovery(struct tcp_cc *cc, uint32_t inflight) {
+  cc->ssthresh = MAX(inflight / 2, TCP_CC_MIN_CWND * cc->mss);
+  cc->cwnd = cc->ssthresh;
+}
+
+const struct tcp_cc_ops tcp_cc_reno = {
+    .name = "reno",
+    .ack = reno_ack,
+    .loss = reno_loss,
+    .recovery = reno_recovery,
+};
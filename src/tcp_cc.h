@@ -0,0 +1,51 @@
+#ifndef TCP_CC_H
+#define TCP_CC_H
+
+#include <stdint.h>
+
+#define TCP_CC_NAME_LEN 16
+#define TCP_CC_PRIV_SIZE 256
+
+#define TCP_CC_INIT_CWND 10 /* segments, see https://tools.ietf.org/html/rfc6928 */
+#define TCP_CC_MIN_CWND 2   /* segments */
+
+/*
+ * Congestion Control
+ *
+ * NOTE: the callbacks are invoked with the TCP mutex locked
+ */
+
+struct tcp_cc_sample {
+  uint32_t acked;           /* newly acknowledged bytes */
+  uint32_t inflight;        /* bytes in flight after the acknowledgement */
+  uint32_t rtt;             /* micro seconds, 0 if no valid sample */
+  uint64_t rate;            /* delivery rate (bytes per second), 0 if no valid sample */
+  uint32_t interval;        /* micro seconds, over which the delivery rate was measured */
+  uint64_t delivered;       /* total bytes delivered so far */
+  uint64_t prior_delivered; /* total bytes delivered when the acknowledged segment was sent */
+};
+
+struct tcp_cc {
+  const struct tcp_cc_ops *ops;
+  uint32_t mss;
+  uint32_t cwnd;        /* bytes */
+  uint32_t ssthresh;    /* bytes */
+  uint64_t pacing_rate; /* bytes per second, 0 if the rate is derived from cwnd and srtt */
+  uint8_t priv[TCP_CC_PRIV_SIZE];
+};
+
+struct tcp_cc_ops {
+  char name[TCP_CC_NAME_LEN];
+  void (*init)(struct tcp_cc *cc);
+  void (*ack)(struct tcp_cc *cc, const struct tcp_cc_sample *rs);
+  void (*loss)(struct tcp_cc *cc, uint32_t inflight);     /* retransmission timeout */
+  void (*recovery)(struct tcp_cc *cc, uint32_t inflight); /* loss detected by ACKs, once per round trip (optional) */
+};
+
+extern const struct tcp_cc_ops tcp_cc_reno;
+extern const struct tcp_cc_ops tcp_cc_bbr;
+
+extern const struct tcp_cc_ops *tcp_cc_lookup(const char *name);
+extern void tcp_cc_init(struct tcp_cc *cc, const struct tcp_cc_ops *ops, uint32_t mss);
+
+#endif
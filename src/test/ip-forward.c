@@ -0,0 +1,116 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "arp.h"
+#include "driver/ether_tap.h"
+#include "icmp.h"
+#include "ip.h"
+#include "net.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Forwards the datagrams between tap0 (192.168.70.0/24) and tap1 (192.168.71.0/24), and reports the rate every second.
+ *
+ *   $ sudo ip tuntap add mode tap name tap1 && sudo ip link set tap1 up
+ *   $ ./src/test/ip-forward.exe &
+ *   $ sudo ip netns add ns1 && sudo ip link set tap1 netns ns1
+ *   $ sudo ip netns exec ns1 sh -c 'ip addr add 192.168.71.1/24 dev tap1; ip link set tap1 up; \
+ *       ip route add default via 192.168.71.2'
+ *   $ sudo ip route add 192.168.71.0/24 via 192.168.70.2
+ *   $ ping 192.168.71.1
+ */
+
+static volatile sig_atomic_t terminate;
+
+static void on_signal(int s) {
+  (void)s;
+  terminate = 1;
+}
+
+static int setup_iface(const char *name, const char *hwaddr, const char *addr, const char *netmask) {
+  struct net_device *dev;
+  struct ip_iface *iface;
+
+  dev = ether_tap_init(name, hwaddr);
+  if (!dev) {
+    errorf("ether_tap_init() failure");
+    return -1;
+  }
+  iface = ip_iface_alloc(addr, netmask);
+  if (!iface) {
+    errorf("ip_iface_alloc() failure");
+    return -1;
+  }
+  if (ip_iface_register(dev, iface) == -1) {
+    errorf("ip_iface_register() failure");
+    return -1;
+  }
+  return 0;
+}
+
+static int setup(void) {
+  signal(SIGINT, on_signal);
+  if (net_init() == -1) {
+    errorf("net_init() failure");
+    return -1;
+  }
+  if (setup_iface(ETHER_TAP_NAME, ETHER_TAP_HW_ADDR, ETHER_TAP_IP_ADDR, ETHER_TAP_NETMASK) == -1 ||
+      setup_iface(ETHER_TAP2_NAME, ETHER_TAP2_HW_ADDR, ETHER_TAP2_IP_ADDR, ETHER_TAP2_NETMASK) == -1) {
+    errorf("setup_iface() failure");
+    return -1;
+  }
+  ip_set_forwarding(1);
+  if (net_run() == -1) {
+    errorf("net_run() failure");
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct ip_stats prev = {}, stats;
+  struct arp_stats arp_stats;
+  struct icmp_stats icmp_stats;
+  struct timeval start, now, diff;
+
+  if (setup() == -1) {
+    errorf("setup() failure");
+    return -1;
+  }
+  gettimeofday(&start, NULL);
+  while (!terminate) {
+    sleep(1);
+    ip_get_stats(&stats);
+    gettimeofday(&now, NULL);
+    timersub(&now, &start, &diff);
+    start = now;
+    double sec = diff.tv_sec + diff.tv_usec / 1000000.0;
+    if (stats.forwarded != prev.forwarded) {
+      infof("forwarded=%.0f pps, datagrams/batch=%.1f, time_exceeded=%lu, unreachable=%lu, frag_needed=%lu, drops=%lu",
+            (stats.forwarded - prev.forwarded) / sec,
+            stats.fwd_batches != prev.fwd_batches
+                ? (double)(stats.forwarded - prev.forwarded) / (stats.fwd_batches - prev.fwd_batches)
+                : 0.0,
+            stats.fwd_time_exceeded, stats.fwd_unreachable, stats.fwd_frag_needed, stats.fwd_drops);
+    }
+    prev = stats;
+  }
+  ip_get_stats(&stats);
+  infof("forwarded=%lu, batches=%lu, time_exceeded=%lu, unreachable=%lu, frag_needed=%lu, drops=%lu", stats.forwarded,
+        stats.fwd_batches, stats.fwd_time_exceeded, stats.fwd_unreachable, stats.fwd_frag_needed, stats.fwd_drops);
+  arp_get_stats(&arp_stats);
+  infof("arp: requests=%lu, failures=%lu, pending=%lu, pending_sent=%lu, pending_drops=%lu, probes=%lu, "
+        "probe_failures=%lu",
+        arp_stats.requests, arp_stats.failures, arp_stats.pending, arp_stats.pending_sent, arp_stats.pending_drops,
+        arp_stats.probes, arp_stats.probe_failures);
+  icmp_get_stats(&icmp_stats);
+  infof("icmp: echo_replies=%lu, reflected=%lu, errors=%lu, rate_limited=%lu", icmp_stats.echo_replies,
+        icmp_stats.reflected, icmp_stats.errors, icmp_stats.rate_limited);
+  net_shutdown();
+  return 0;
+}
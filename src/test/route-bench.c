@@ -0,0 +1,145 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "driver/dummy.h"
+#include "ip.h"
+#include "net.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Loads a routing table of random prefixes and compares the lookups per second of the routing table with the search
+ * through the list of routes, checking that both give the same interface.
+ *
+ *   $ ./src/test/route-bench.exe 100000   # number of prefixes
+ */
+
+#define DEFAULT_PREFIXES 100000
+#define IFACE_NUM 4
+#define LOOKUPS 10000000
+#define LINEAR_LOOKUPS 200
+
+/* roughly the share of the prefix lengths in a full table, with some longer than /24 */
+static int random_prefixlen(void) {
+  int r = random() % 100;
+
+  if (r < 60) {
+    return 24;
+  }
+  if (r < 75) {
+    return 17 + random() % 7;
+  }
+  if (r < 90) {
+    return 8 + random() % 9;
+  }
+  return 25 + random() % 8;
+}
+
+/* an address inside one of the prefixes for the half of the lookups, anywhere for the other half */
+static ip_addr_t random_dst(const ip_addr_t *networks, size_t num) {
+  if (random() % 2) {
+    return networks[random() % num] | hton32(random() & 0xff);
+  }
+  return (ip_addr_t)random() << 1 ^ random();
+}
+
+static double elapsed(const struct timeval *start) {
+  struct timeval end, diff;
+
+  gettimeofday(&end, NULL);
+  timersub(&end, start, &diff);
+  return diff.tv_sec + diff.tv_usec / 1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+  size_t num = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_PREFIXES;
+
+  if (net_init() == -1) {
+    errorf("net_init() failure");
+    return -1;
+  }
+  struct ip_iface *ifaces[IFACE_NUM];
+  for (int i = 0; i < IFACE_NUM; i++) {
+    struct net_device *dev = dummy_init();
+    if (!dev) {
+      errorf("dummy_init() failure");
+      return -1;
+    }
+    char addr[IP_ADDR_STR_LEN];
+    snprintf(addr, sizeof(addr), "172.16.%d.1", i);
+    ifaces[i] = ip_iface_alloc(addr, "255.255.255.0");
+    if (!ifaces[i] || ip_iface_register(dev, ifaces[i]) == -1) {
+      errorf("ip_iface_register() failure");
+      return -1;
+    }
+  }
+  if (net_run() == -1) {
+    errorf("net_run() failure");
+    return -1;
+  }
+
+  /* NOTE: loaded after net_run(), as a routing daemon would do */
+  ip_addr_t *networks = calloc(num, sizeof(*networks));
+  if (!networks) {
+    errorf("calloc() failure");
+    net_shutdown();
+    return -1;
+  }
+  srandom(1);
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for (size_t i = 0; i < num; i++) {
+    int len = random_prefixlen();
+    ip_addr_t netmask = hton32(0xffffffff << (32 - len));
+    networks[i] = ((ip_addr_t)random() << 1 ^ random()) & netmask;
+    if (ip_route_add_prefix(networks[i], netmask, IP_ADDR_ANY, ifaces[random() % IFACE_NUM]) == -1) {
+      errorf("ip_route_add_prefix() failure");
+      net_shutdown();
+      return -1;
+    }
+  }
+  infof("loaded %zu prefixes in %.3f sec, chunks=%zu (%zu KB)", num, elapsed(&start), ip_route_table_chunks(),
+        ip_route_table_chunks() * 256 * sizeof(uintptr_t) / 1024);
+
+  ip_addr_t *dsts = calloc(LOOKUPS, sizeof(*dsts));
+  if (!dsts) {
+    errorf("calloc() failure");
+    net_shutdown();
+    return -1;
+  }
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    dsts[i] = random_dst(networks, num);
+  }
+
+  volatile uintptr_t sink = 0;
+  gettimeofday(&start, NULL);
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    sink ^= (uintptr_t)ip_route_get_iface(dsts[i]);
+  }
+  double table = LOOKUPS / elapsed(&start);
+  gettimeofday(&start, NULL);
+  for (size_t i = 0; i < LINEAR_LOOKUPS; i++) {
+    sink ^= (uintptr_t)ip_route_get_iface_linear(dsts[i]);
+  }
+  double linear = LINEAR_LOOKUPS / elapsed(&start);
+  infof("lookups/sec: table=%.0f, list=%.0f (x%.0f)", table, linear, table / linear);
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < LINEAR_LOOKUPS; i++) {
+    if (ip_route_get_iface(dsts[i]) != ip_route_get_iface_linear(dsts[i])) {
+      mismatches++;
+    }
+  }
+  infof("checked %d lookups against the list, mismatches=%zu", LINEAR_LOOKUPS, mismatches);
+
+  free(dsts);
+  free(networks);
+  net_shutdown();
+
+  return mismatches ? -1 : 0;
+}
@@ -123,17 +123,11 @@ void http_handler(int soc, uint8_t *reqbuf, size_t reqsize) {
           finfo.st_size);
   tcp_send(soc, (uint8_t *)headerbuf, strlen(headerbuf));
 
-  uint8_t bodybuf[1400];
-  int n_read;
-  while ((n_read = read(fd, bodybuf, sizeof(bodybuf))) != 0) {
-    if (n_read < 0) {
-      tcp_send(soc, (uint8_t *)response_500, strlen(response_500));
-
-      close(fd);
-      return;
-    }
+  if (tcp_sendfile(soc, fd, 0, finfo.st_size) == -1) {
+    tcp_send(soc, (uint8_t *)response_500, strlen(response_500));
 
-    tcp_send(soc, bodybuf, n_read);
+    close(fd);
+    return;
   }
 
   close(fd);
@@ -210,10 +204,14 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  /* accept requests carried by SYN from the clients which have a cookie */
+  tcp_set_fastopen(TCP_FASTOPEN_CLIENT | TCP_FASTOPEN_SERVER);
+
   /*
    * main
    */
 
+  /* NOTE: the listeners of the workers form a reuseport group, the connections are spread over them by flow hash */
   pthread_t thread;
   for (int i = 0; i < WORKER_THREAD_NUM; i++) {
     if (pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
@@ -226,6 +224,16 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
+  struct tcp_stats stats;
+  tcp_get_stats(&stats);
+  infof("reuseport_steered=%lu", stats.reuseport_steered);
+  struct ip_stats ip_stats;
+  ip_get_stats(&ip_stats);
+  infof("frags_in=%lu, reassembled=%lu, reass_timeouts=%lu, reass_drops=%lu, fragmented=%lu, frags_out=%lu",
+        ip_stats.frags_in, ip_stats.reassembled, ip_stats.reass_timeouts, ip_stats.reass_drops, ip_stats.fragmented,
+        ip_stats.frags_out);
+  infof("pmtu_updates=%lu, frag_needed=%lu", ip_stats.pmtu_updates, ip_stats.frag_needed);
+
   /*
    * cleanup
    */
@@ -0,0 +1,115 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "driver/ether_tap.h"
+#include "ip.h"
+#include "net.h"
+#include "tcp.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Receives bulk data on 192.168.70.2:10007 to see the receive buffer auto-tuning.
+ *
+ *   $ ./src/test/tcp-bulk-recv.exe
+ *   $ head -c 100000000 /dev/zero | nc -N 192.168.70.2 10007   # on the host
+ */
+
+static volatile sig_atomic_t terminate;
+
+static void on_signal(int s) {
+  (void)s;
+  terminate = 1;
+  net_raise_event();
+}
+
+static int setup(void) {
+  struct net_device *dev;
+  struct ip_iface *iface;
+
+  signal(SIGINT, on_signal);
+  if (net_init() == -1) {
+    errorf("net_init() failure");
+    return -1;
+  }
+  dev = ether_tap_init(ETHER_TAP_NAME, ETHER_TAP_HW_ADDR);
+  if (!dev) {
+    errorf("ether_tap_init() failure");
+    return -1;
+  }
+  iface = ip_iface_alloc(ETHER_TAP_IP_ADDR, ETHER_TAP_NETMASK);
+  if (!iface) {
+    errorf("ip_iface_alloc() failure");
+    return -1;
+  }
+  if (ip_iface_register(dev, iface) == -1) {
+    errorf("ip_iface_register() failure");
+    return -1;
+  }
+  if (net_run() == -1) {
+    errorf("net_run() failure");
+    return -1;
+  }
+  return 0;
+}
+
+static void cleanup(void) {
+  sleep(1);
+  net_shutdown();
+}
+
+int main(int argc, char *argv[]) {
+  if (setup() == -1) {
+    errorf("setup() failure");
+    return -1;
+  }
+
+  struct ip_endpoint local;
+  ip_endpoint_pton("192.168.70.2:10007", &local);
+  int soc = tcp_open_rfc793(&local, NULL, 0);
+  if (soc == -1) {
+    errorf("tcp_open_rfc793() failure");
+    cleanup();
+    return -1;
+  }
+
+  uint8_t buf[65536];
+  struct timeval start, end, diff;
+  gettimeofday(&start, NULL);
+  size_t total = 0;
+  while (!terminate) {
+    ssize_t ret = tcp_receive(soc, buf, sizeof(buf));
+    if (ret <= 0) {
+      break;
+    }
+    total += ret;
+  }
+  gettimeofday(&end, NULL);
+  timersub(&end, &start, &diff);
+
+  struct tcp_stats stats;
+  tcp_get_stats(&stats);
+  double sec = diff.tv_sec + diff.tv_usec / 1000000.0;
+  infof("received=%zu bytes, elapsed=%.3f sec, throughput=%.2f Mbps", total, sec, total * 8 / sec / 1000000);
+  infof("segs_in=%lu, rcvbuf_grows=%lu, rcvbuf_shrinks=%lu, window_updates=%lu", stats.segs_in, stats.rcvbuf_grows,
+        stats.rcvbuf_shrinks, stats.window_updates);
+  infof("gro_merged=%lu, frames/segment=%.2f, direct_copies=%lu", stats.gro_merged,
+        stats.segs_in ? (double)(stats.segs_in + stats.gro_merged) / stats.segs_in : 0.0, stats.direct_copies);
+  uint64_t predicted = stats.predicted_acks + stats.predicted_data;
+  infof("predicted_acks=%lu, predicted_data=%lu, hit rate=%.1f%%", stats.predicted_acks, stats.predicted_data,
+        stats.segs_in ? predicted * 100.0 / stats.segs_in : 0.0);
+  infof("cycles/segment: fast path=%lu, slow path=%lu", predicted ? stats.fastpath_cycles / predicted : 0,
+        stats.segs_in > predicted ? stats.slowpath_cycles / (stats.segs_in - predicted) : 0);
+
+  tcp_close(soc);
+  cleanup();
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "driver/ether_tap.h"
+#include "ip.h"
+#include "net.h"
+#include "tcp.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Sends bulk data to 192.168.70.1:10007 to compare congestion controllers.
+ *
+ *   $ ./scripts/setup_bottleneck.sh               # optional: emulated bottleneck on tap0
+ *   $ nc -l 192.168.70.1 10007 > /dev/null        # sink on the host
+ *   $ ./src/test/tcp-bulk-send.exe bbr 10000000   # or "reno"
+ *   $ ./src/test/tcp-bulk-send.exe reno 10000000 zc  # with tcp_send_zc()
+ */
+
+#define DEFAULT_SIZE (8 * 1024 * 1024)
+#define ZC_BUF_SIZE (1024 * 1024)
+
+static volatile sig_atomic_t terminate;
+
+static void on_signal(int s) {
+  (void)s;
+  terminate = 1;
+  net_raise_event();
+}
+
+static int setup(void) {
+  struct net_device *dev;
+  struct ip_iface *iface;
+
+  signal(SIGINT, on_signal);
+  if (net_init() == -1) {
+    errorf("net_init() failure");
+    return -1;
+  }
+  dev = ether_tap_init(ETHER_TAP_NAME, ETHER_TAP_HW_ADDR);
+  if (!dev) {
+    errorf("ether_tap_init() failure");
+    return -1;
+  }
+  iface = ip_iface_alloc(ETHER_TAP_IP_ADDR, ETHER_TAP_NETMASK);
+  if (!iface) {
+    errorf("ip_iface_alloc() failure");
+    return -1;
+  }
+  if (ip_iface_register(dev, iface) == -1) {
+    errorf("ip_iface_register() failure");
+    return -1;
+  }
+  if (net_run() == -1) {
+    errorf("net_run() failure");
+    return -1;
+  }
+  return 0;
+}
+
+static void cleanup(void) {
+  sleep(1);
+  net_shutdown();
+}
+
+int main(int argc, char *argv[]) {
+  const char *cc = argc > 1 ? argv[1] : "reno";
+  size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_SIZE;
+  int zc = argc > 3 && strcmp(argv[3], "zc") == 0;
+
+  if (setup() == -1) {
+    errorf("setup() failure");
+    return -1;
+  }
+  if (tcp_set_congestion_control(cc) == -1) {
+    errorf("tcp_set_congestion_control() failure");
+    cleanup();
+    return -1;
+  }
+
+  struct ip_endpoint local, foreign;
+  ip_endpoint_pton("192.168.70.2:7", &local);
+  ip_endpoint_pton("192.168.70.1:10007", &foreign);
+  int soc = tcp_open_rfc793(&local, &foreign, 1);
+  if (soc == -1) {
+    errorf("tcp_open_rfc793() failure");
+    cleanup();
+    return -1;
+  }
+
+  uint8_t buf[16384];
+  memset(buf, 'x', sizeof(buf));
+  static uint8_t zcbuf[2][ZC_BUF_SIZE];
+  memset(zcbuf, 'x', sizeof(zcbuf));
+  int pending[2] = {};
+  uint64_t cookies[2];
+  struct timeval start, end, diff;
+  gettimeofday(&start, NULL);
+  size_t total = 0;
+  for (uint64_t n = 0; !terminate && total < size; n++) {
+    ssize_t ret;
+    if (zc) {
+      /* NOTE: a buffer is written again only after the stack has reported it completed */
+      while (pending[n % 2]) {
+        ssize_t reaped = tcp_zc_reap(soc, cookies, countof(cookies));
+        if (reaped <= 0) {
+          break;
+        }
+        for (ssize_t i = 0; i < reaped; i++) {
+          pending[cookies[i] % 2] = 0;
+        }
+      }
+      pending[n % 2] = 1;
+      ret = tcp_send_zc(soc, zcbuf[n % 2], MIN(sizeof(zcbuf[0]), size - total), n);
+    } else {
+      ret = tcp_send(soc, buf, MIN(sizeof(buf), size - total));
+    }
+    if (ret <= 0) {
+      break;
+    }
+    total += ret;
+  }
+  gettimeofday(&end, NULL);
+  timersub(&end, &start, &diff);
+
+  struct tcp_stats stats;
+  tcp_get_stats(&stats);
+  double sec = diff.tv_sec + diff.tv_usec / 1000000.0;
+  infof("cc=%s, sent=%zu bytes, elapsed=%.3f sec, throughput=%.2f Mbps", cc, total, sec, total * 8 / sec / 1000000);
+  infof("segs_out=%lu, gso_batches=%lu, retransmits=%lu, pacing_waits=%lu, window_probes=%lu", stats.segs_out,
+        stats.gso_batches, stats.retransmits, stats.pacing_waits, stats.window_probes);
+  infof("rack_retransmits=%lu, tlp_probes=%lu, zc_completions=%lu, pmtu_shrinks=%lu", stats.rack_retransmits,
+        stats.tlp_probes, stats.zc_completions, stats.pmtu_shrinks);
+  uint64_t predicted = stats.predicted_acks + stats.predicted_data;
+  infof("predicted_acks=%lu, predicted_data=%lu, hit rate=%.1f%%", stats.predicted_acks, stats.predicted_data,
+        stats.segs_in ? predicted * 100.0 / stats.segs_in : 0.0);
+  infof("cycles/segment: fast path=%lu, slow path=%lu", predicted ? stats.fastpath_cycles / predicted : 0,
+        stats.segs_in > predicted ? stats.slowpath_cycles / (stats.segs_in - predicted) : 0);
+
+  tcp_close(soc);
+  cleanup();
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "driver/ether_tap.h"
+#include "ip.h"
+#include "net.h"
+#include "tcp.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Sends HTTP requests to 192.168.70.1:8080 with TCP Fast Open.
+ * The first connection obtains a cookie, the following ones carry the request on SYN.
+ *
+ *   $ sudo sysctl -w net.ipv4.tcp_fastopen=3   # enable server side on the host
+ *   $ ./scripts/fastopen_http_server.py
+ *   $ ./src/test/tcp-fastopen-client.exe 3
+ */
+
+#define DEFAULT_COUNT 3
+
+static volatile sig_atomic_t terminate;
+
+static void on_signal(int s) {
+  (void)s;
+  terminate = 1;
+  net_raise_event();
+}
+
+static int setup(void) {
+  struct net_device *dev;
+  struct ip_iface *iface;
+
+  signal(SIGINT, on_signal);
+  if (net_init() == -1) {
+    errorf("net_init() failure");
+    return -1;
+  }
+  dev = ether_tap_init(ETHER_TAP_NAME, ETHER_TAP_HW_ADDR);
+  if (!dev) {
+    errorf("ether_tap_init() failure");
+    return -1;
+  }
+  iface = ip_iface_alloc(ETHER_TAP_IP_ADDR, ETHER_TAP_NETMASK);
+  if (!iface) {
+    errorf("ip_iface_alloc() failure");
+    return -1;
+  }
+  if (ip_iface_register(dev, iface) == -1) {
+    errorf("ip_iface_register() failure");
+    return -1;
+  }
+  if (net_run() == -1) {
+    errorf("net_run() failure");
+    return -1;
+  }
+  return 0;
+}
+
+static void cleanup(void) {
+  sleep(1);
+  net_shutdown();
+}
+
+int main(int argc, char *argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+  char *request =
+      "GET / HTTP/1.1\r\n"
+      "Host: 192.168.70.1\r\n"
+      "Connection: close\r\n"
+      "\r\n";
+
+  if (setup() == -1) {
+    errorf("setup() failure");
+    return -1;
+  }
+
+  for (int i = 0; i < count && !terminate; i++) {
+    struct ip_endpoint local, foreign;
+    char ep[32];
+    snprintf(ep, sizeof(ep), "192.168.70.2:%d", 49152 + (getpid() + i) % 16384); /* dynamic ports */
+    ip_endpoint_pton(ep, &local);
+    ip_endpoint_pton("192.168.70.1:8080", &foreign);
+
+    struct timeval start, first, diff;
+    gettimeofday(&start, NULL);
+    int soc = tcp_open_fastopen(&local, &foreign, (uint8_t *)request, strlen(request));
+    if (soc == -1) {
+      errorf("tcp_open_fastopen() failure");
+      break;
+    }
+    uint8_t buf[2048];
+    size_t total = 0;
+    timerclear(&first);
+    while (!terminate) {
+      ssize_t ret = tcp_receive(soc, buf, sizeof(buf));
+      if (ret <= 0) {
+        break;
+      }
+      if (!timerisset(&first)) {
+        gettimeofday(&first, NULL);
+      }
+      total += ret;
+    }
+    tcp_close(soc);
+    timersub(&first, &start, &diff);
+    infof("#%d: received=%zu bytes, time to first byte=%ld usec", i, total, diff.tv_sec * 1000000 + diff.tv_usec);
+  }
+
+  struct tcp_stats stats;
+  tcp_get_stats(&stats);
+  infof("fastopen_cookie_reqs=%lu, fastopen_active=%lu", stats.fastopen_cookie_reqs, stats.fastopen_active);
+
+  /* NOTE: the connections after the first one start from the RTT measured by the previous ones */
+  struct tcp_metrics metrics[8];
+  size_t n = tcp_metrics_dump(metrics, countof(metrics));
+  for (size_t i = 0; i < n; i++) {
+    char addr[IP_ADDR_STR_LEN];
+    infof("metrics: addr=%s, srtt=%u, rttvar=%u, ssthresh=%u, cwnd=%u, mtu=%u",
+          ip_addr_ntop(metrics[i].addr, addr, sizeof(addr)), metrics[i].srtt, metrics[i].rttvar, metrics[i].ssthresh,
+          metrics[i].cwnd, metrics[i].mtu);
+  }
+
+  cleanup();
+
+  return 0;
+}
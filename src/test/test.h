@@ -16,6 +16,12 @@
 
 #define DEFAULT_GATEWAY "192.168.70.1"
 
+/* second tap for the forwarding between two networks (TEST-NET-1 neighbor) */
+#define ETHER_TAP2_NAME "tap1"
+#define ETHER_TAP2_HW_ADDR "00:00:5e:00:53:02"
+#define ETHER_TAP2_IP_ADDR "192.168.71.2"
+#define ETHER_TAP2_NETMASK "255.255.255.0"
+
 const uint8_t test_data[] = {0x45, 0x00, 0x00, 0x30, 0x00, 0x80, 0x00, 0x00, 0xff, 0x01, 0xbd, 0x4a,
                              0x7f, 0x00, 0x00, 0x01, 0x7f, 0x00, 0x00, 0x01, 0x08, 0x00, 0x35, 0x64,
                              0x00, 0x80, 0x00, 0x01, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
@@ -43,6 +43,11 @@ struct udp_pcb {
   struct ip_endpoint local;
   struct queue_head queue; /* receive queue */
   struct sched_ctx ctx;
+  struct {
+    ip_addr_t src;
+    ip_addr_t dst; /* IP_ADDR_ANY if not built yet */
+    struct ip_hdr_template ip;
+  } tmpl; /* headers toward the last destination, reused while a socket keeps sending to the same peer */
 };
 
 struct udp_queue_entry {
@@ -100,6 +105,7 @@ static void udp_pcb_release(struct udp_pcb *pcb) {
   pcb->state = UDP_PCB_STATE_FREE;
   pcb->local.addr = IP_ADDR_ANY;
   pcb->local.port = 0;
+  pcb->tmpl.dst = IP_ADDR_ANY;
   while (1) { /* Discard the entries in the queue. */
     entry = queue_pop(&pcb->queue);
     if (!entry) {
@@ -141,7 +147,7 @@ static struct udp_pcb *udp_pcb_get(int id) {
 
 static int udp_pcb_id(struct udp_pcb *pcb) { return indexof(pcbs, pcb); }
 
-static void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
+void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface) {
   struct pseudo_hdr pseudo;
   uint16_t psum = 0;
   struct udp_hdr *hdr;
@@ -165,11 +171,7 @@ static void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   pseudo.protocol = IP_PROTOCOL_UDP;
   pseudo.len = hton16(len);
   psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), 0);
-  if (cksum16((uint16_t *)hdr, len, psum) != 0) {
-    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
-           ntoh16(cksum16((uint16_t *)hdr, len, -hdr->sum + psum)));
-    return;
-  }
+  /* NOTE: the checksum is verified along with the copy of the payload into the queue entry */
 
   size_t data_len = len - sizeof(*hdr);
   debugf("%s:%d => %s:%d, len=%zu (payload=%zu)", ip_addr_ntop(src, addr1, sizeof(addr1)), ntoh16(hdr->src),
@@ -194,7 +196,14 @@ static void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   entry->foreign.addr = src;
   entry->foreign.port = hdr->src;
   entry->len = data_len;
-  memcpy(entry->data, hdr + 1, data_len);
+  uint32_t sum = cksum16_copy(entry->data, hdr + 1, data_len, 0);
+  if (cksum16((uint16_t *)hdr, sizeof(*hdr), psum + sum) != 0) {
+    mutex_unlock(&mutex);
+    errorf("checksum error: sum=0x%04x, verify=0x%04x", ntoh16(hdr->sum),
+           ntoh16(cksum16((uint16_t *)hdr, len, -hdr->sum + psum)));
+    memory_free(entry);
+    return;
+  }
   if (!queue_push(&pcb->queue, entry)) {
     mutex_unlock(&mutex);
     errorf("queue_push() failure");
@@ -207,7 +216,8 @@ static void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t
   mutex_unlock(&mutex);
 }
 
-ssize_t udp_output(struct ip_endpoint *src, struct ip_endpoint *dst, const uint8_t *data, size_t len) {
+static ssize_t udp_output_template(struct ip_endpoint *src, struct ip_endpoint *dst, const struct ip_hdr_template *tmpl,
+                                   const uint8_t *data, size_t len) {
   struct udp_hdr *hdr;
 
   if (len > IP_PAYLOAD_SIZE_MAX - sizeof(*hdr)) {
@@ -217,22 +227,14 @@ ssize_t udp_output(struct ip_endpoint *src, struct ip_endpoint *dst, const uint8
 
   uint16_t udp_len = sizeof(*hdr) + len;
 
-  struct pseudo_hdr pseudo;
-  pseudo.src = src->addr;
-  pseudo.dst = dst->addr;
-  pseudo.zero = 0;
-  pseudo.protocol = IP_PROTOCOL_UDP;
-  pseudo.len = hton16(udp_len);
-  uint16_t psum = ~cksum16((uint16_t *)&pseudo, sizeof(pseudo), 0);
-
   uint8_t buf[IP_PAYLOAD_SIZE_MAX];
   hdr = (struct udp_hdr *)buf;
   hdr->src = src->port;
   hdr->dst = dst->port;
   hdr->len = hton16(udp_len);
   hdr->sum = 0;
-  memcpy(hdr + 1, data, len);
-  hdr->sum = cksum16((uint16_t *)hdr, udp_len, psum);
+  uint32_t sum = cksum16_copy(hdr + 1, data, len, ip_hdr_template_psum(tmpl, udp_len));
+  hdr->sum = cksum16((uint16_t *)hdr, sizeof(*hdr), sum);
 
   char ep1[IP_ENDPOINT_STR_LEN];
   char ep2[IP_ENDPOINT_STR_LEN];
@@ -240,14 +242,32 @@ ssize_t udp_output(struct ip_endpoint *src, struct ip_endpoint *dst, const uint8
          ip_endpoint_ntop(dst, ep2, sizeof(ep2)), udp_len, len);
   udp_dump((uint8_t *)hdr, udp_len);
 
-  if (ip_output(IP_PROTOCOL_UDP, buf, udp_len, src->addr, dst->addr) == -1) {
-    errorf("ip_output() failure");
+  if (ip_output_template(tmpl, buf, udp_len, NULL) == -1) {
+    errorf("ip_output_template() failure");
     return -1;
   }
 
   return len;
 }
 
+ssize_t udp_output(struct ip_endpoint *src, struct ip_endpoint *dst, const uint8_t *data, size_t len) {
+  struct ip_hdr_template tmpl;
+  struct ip_iface *iface;
+  char addr[IP_ADDR_STR_LEN];
+
+  if (src->addr == IP_ADDR_ANY) {
+    iface = ip_route_get_iface(dst->addr);
+    if (!iface) {
+      errorf("iface not found that can reach foreign address, addr=%s", ip_addr_ntop(dst->addr, addr, sizeof(addr)));
+      return -1;
+    }
+    ip_hdr_template_init(&tmpl, IP_PROTOCOL_UDP, iface->unicast, dst->addr);
+  } else {
+    ip_hdr_template_init(&tmpl, IP_PROTOCOL_UDP, src->addr, dst->addr);
+  }
+  return udp_output_template(src, dst, &tmpl, data, len);
+}
+
 static void event_handler(void *arg) {
   struct udp_pcb *pcb;
 
@@ -342,6 +362,7 @@ int udp_bind(int id, struct ip_endpoint *local) {
 ssize_t udp_sendto(int id, uint8_t *data, size_t len, struct ip_endpoint *foreign) {
   struct udp_pcb *pcb;
   struct ip_endpoint local;
+  struct ip_hdr_template tmpl;
   struct ip_iface *iface;
   char addr[IP_ADDR_STR_LEN];
   uint32_t p;
@@ -380,8 +401,14 @@ ssize_t udp_sendto(int id, uint8_t *data, size_t len, struct ip_endpoint *foreig
     }
   }
   local.port = pcb->local.port;
+  if (pcb->tmpl.dst == IP_ADDR_ANY || pcb->tmpl.src != local.addr || pcb->tmpl.dst != foreign->addr) {
+    ip_hdr_template_init(&pcb->tmpl.ip, IP_PROTOCOL_UDP, local.addr, foreign->addr);
+    pcb->tmpl.src = local.addr;
+    pcb->tmpl.dst = foreign->addr;
+  }
+  tmpl = pcb->tmpl.ip;
   mutex_unlock(&mutex);
-  return udp_output(&local, foreign, data, len);
+  return udp_output_template(&local, foreign, &tmpl, data, len);
 }
 
 ssize_t udp_recvfrom(int id, uint8_t *buf, size_t size, struct ip_endpoint *foreign) {
@@ -6,6 +6,7 @@
 
 #include "ip.h"
 
+extern void udp_input(const uint8_t *data, size_t len, ip_addr_t src, ip_addr_t dst, struct ip_iface *iface);
 extern ssize_t udp_output(struct ip_endpoint *src, struct ip_endpoint *dst, const uint8_t *buf, size_t len);
 
 extern int udp_init(void);
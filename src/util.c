@@ -133,6 +133,33 @@ void *queue_peek(struct queue_head *queue) {
   return queue->head->data;
 }
 
+void *queue_remove(struct queue_head *queue, void *data) {
+  struct queue_entry *entry, *prev = NULL;
+
+  if (!queue) {
+    return NULL;
+  }
+  for (entry = queue->head; entry; prev = entry, entry = entry->next) {
+    if (entry->data == data) {
+      break;
+    }
+  }
+  if (!entry) {
+    return NULL;
+  }
+  if (prev) {
+    prev->next = entry->next;
+  } else {
+    queue->head = entry->next;
+  }
+  if (queue->tail == entry) {
+    queue->tail = prev;
+  }
+  queue->num--;
+  memory_free(entry);
+  return data;
+}
+
 void queue_foreach(struct queue_head *queue, void (*func)(void *arg, void *data), void *arg) {
   struct queue_entry *entry;
 
@@ -203,10 +230,13 @@ uint32_t ntoh32(uint32_t n) {
 
 uint16_t cksum16(uint16_t *addr, uint16_t count, uint32_t init) {
   uint32_t sum;
+  uint16_t w;
 
   sum = init;
   while (count > 1) {
-    sum += *(addr++);
+    /* NOTE: callers pass headers written through other types, memcpy() keeps it clear of strict aliasing */
+    memcpy(&w, addr++, sizeof(w));
+    sum += w;
     count -= 2;
   }
   if (count > 0) {
@@ -217,3 +247,111 @@ uint16_t cksum16(uint16_t *addr, uint16_t count, uint32_t init) {
   }
   return ~(uint16_t)sum;
 }
+
+/*
+ * Copies len bytes and sums them up in a single pass, so that the data is read from memory once. Returns the partial
+ * sum (folded but not complemented), to be passed to cksum16() as init.
+ *
+ * NOTE: dst and src are expected to start at an even offset of the checksummed data
+ */
+uint32_t cksum16_copy(void *dst, const void *src, size_t len, uint32_t init) {
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  uint64_t sum = init, v;
+  uint16_t w;
+
+  /* NOTE: sums 32-bit words, which folds to the same 16-bit sum */
+  while (len >= sizeof(v)) {
+    memcpy(&v, s, sizeof(v));
+    memcpy(d, &v, sizeof(v));
+    sum += (v & 0xffffffff) + (v >> 32);
+    s += sizeof(v);
+    d += sizeof(v);
+    len -= sizeof(v);
+  }
+  while (len > 1) {
+    memcpy(&w, s, sizeof(w));
+    memcpy(d, &w, sizeof(w));
+    sum += w;
+    s += sizeof(w);
+    d += sizeof(w);
+    len -= sizeof(w);
+  }
+  if (len > 0) {
+    *d = *s;
+    sum += *s;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+/*
+ * Hash
+ */
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND           \
+  do {                     \
+    v0 += v1;              \
+    v1 = ROTL64(v1, 13);   \
+    v1 ^= v0;              \
+    v0 = ROTL64(v0, 32);   \
+    v2 += v3;              \
+    v3 = ROTL64(v3, 16);   \
+    v3 ^= v2;              \
+    v0 += v3;              \
+    v3 = ROTL64(v3, 21);   \
+    v3 ^= v0;              \
+    v2 += v1;              \
+    v1 = ROTL64(v1, 17);   \
+    v1 ^= v2;              \
+    v2 = ROTL64(v2, 32);   \
+  } while (0)
+
+static uint64_t load64_le(const uint8_t *p) {
+  uint64_t v = 0;
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+/* SipHash-2-4, see https://www.aumasson.jp/siphash/siphash.pdf */
+uint64_t siphash(const uint8_t key[SIPHASH_KEY_LEN], const void *data, size_t len) {
+  const uint8_t *p = data;
+  uint64_t k0, k1, v0, v1, v2, v3, m, b;
+  size_t i;
+
+  k0 = load64_le(key);
+  k1 = load64_le(key + 8);
+  v0 = k0 ^ 0x736f6d6570736575ULL;
+  v1 = k1 ^ 0x646f72616e646f6dULL;
+  v2 = k0 ^ 0x6c7967656e657261ULL;
+  v3 = k1 ^ 0x7465646279746573ULL;
+  for (i = 0; i + 8 <= len; i += 8) {
+    m = load64_le(p + i);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  b = (uint64_t)len << 56;
+  for (; i < len; i++) {
+    b |= (uint64_t)p[i] << (8 * (i % 8));
+  }
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -82,6 +82,7 @@ extern void queue_init(struct queue_head *queue);
 extern void *queue_push(struct queue_head *queue, void *data);
 extern void *queue_pop(struct queue_head *queue);
 extern void *queue_peek(struct queue_head *queue);
+extern void *queue_remove(struct queue_head *queue, void *data); /* returns NULL if data is not on the queue */
 extern void queue_foreach(struct queue_head *queue, void (*func)(void *arg, void *data), void *arg);
 
 /*
@@ -98,5 +99,14 @@ extern uint32_t ntoh32(uint32_t n);
  */
 
 extern uint16_t cksum16(uint16_t *addr, uint16_t count, uint32_t init);
+extern uint32_t cksum16_copy(void *dst, const void *src, size_t len, uint32_t init);
+
+/*
+ * Hash
+ */
+
+#define SIPHASH_KEY_LEN 16
+
+extern uint64_t siphash(const uint8_t key[SIPHASH_KEY_LEN], const void *data, size_t len);
 
 #endif